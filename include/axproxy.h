@@ -9,43 +9,123 @@
 #include "config.h"
 #include "dns.h"
 
-#define L_ACCEPT                    0
-
 #define LEVEL_SOCKS_VER             1
 #define LEVEL_SOCKS_AUTH            2
 #define LEVEL_SOCKS_REQ             3
 #define LEVEL_SOCKS_PASS            4
+#define LEVEL_SOCKS_FAIL            5
 
 #define EPOLLREF                    ((struct pollfd*) -1)
 
+#define LIST_OTHER                  0
+#define LIST_HANDSHAKE              1
+#define LIST_CONNECTING             2
+#define LIST_ESTABLISHED            3
+#define STREAM_LISTS                4
+
 /**
- * Utility data queue
+ * Handshake data queue, pooled
  */
 struct queue_t
 {
+    struct queue_t *next;
     size_t len;
     uint8_t arr[DATA_QUEUE_CAPACITY];
 };
 
+/**
+ * Relay chunk structure
+ */
+struct chunk_t
+{
+    struct chunk_t *next;
+    size_t off;
+    size_t len;
+    size_t size;
+    int eof;
+    uint8_t arr[];
+};
+
+/**
+ * Splice relay pipe structure
+ */
+struct pipe_t
+{
+    struct pipe_t *next;
+    int fd[2];
+    size_t len;
+    size_t size;
+};
+
+/**
+ * io_uring backend state
+ */
+struct proxy_uring_t;
+
+/**
+ * Kernel relay state
+ */
+struct proxy_sockmap_t;
+
+/**
+ * Relation traffic class entry
+ */
+struct flow_t;
+
+/**
+ * UDP association batch state
+ */
+struct proxy_udp_t;
+
+/**
+ * Destination socket profile
+ */
+struct profile_t;
+
+/**
+ * Client source address table entry
+ */
+struct source_t;
+
 /**
  * IP/TCP connection stream
  */
 struct stream_t
 {
-    int role;
+    /* Hot fields fit the first cache line */
     int fd;
-    int level;
-    int allocated;
-    int abandoned;
     short events;
     short levents;
     short revents;
+    short readiness;
+    short role;
+    short level;
+    unsigned int generation;
+    unsigned int index;
+    unsigned char allocated;
+    unsigned char abandoned;
+    unsigned char dirty;
+    unsigned char list;
+    unsigned int source;
 
-    struct pollfd *pollref;
     struct stream_t *neighbour;
+    struct pollfd *pollref;
+    struct stream_t *dirty_next;
+    struct queue_t *queue;
+
+    /* Cold fields follow */
     struct stream_t *prev;
     struct stream_t *next;
-    struct queue_t queue;
+    struct stream_t *abandoned_next;
+    struct stream_t *timer_next;
+    struct stream_t **timer_link;
+    struct stream_t **dirty_link;
+    unsigned int deadline;
+    unsigned int ready_slot;
+    unsigned int active;
+    unsigned int relay_len;
+    unsigned int sndbuf;
+    unsigned long long bytes;
 };
 
 /**
@@ -56,11 +136,111 @@ struct proxy_t
     size_t stream_size;
     int verbose;
     int epoll_fd;
-    struct stream_t *stream_head;
-    struct stream_t *stream_tail;
-    struct stream_t stream_pool[POOL_SIZE];
+    int workers;
+    int worker_id;
+    int worker_cpu;
+    int cpu_pinning;
+    int edge_triggered;
+    int io_uring;
+    int splice;
+    int kernel_relay;
+    int prioritize;
+    int interactive_tos;
+    long busy_poll;
+    int fast_open;
+    size_t max_conns;
+    long idle_timeout;
+    int listen_backlog;
+    int defer_accept;
+    long stall_threshold;
+    int shed_occupancy;
+    long shed_lag;
+    long source_conns;
+    long source_rate;
+    size_t tune_limit;
+    size_t tune_used;
+    size_t stream_limit;
+    size_t stream_total;
+    size_t stream_count;
+    unsigned long stat_accepted;
+    unsigned long stat_relations;
+    unsigned long stat_cpu_local;
+    unsigned long stat_epoll_ctl;
+    unsigned long stat_uring_enter;
+    unsigned long long stat_forwarded;
+    unsigned long long stat_spliced;
+    unsigned long stat_stalls;
+    unsigned long stat_shed_accept;
+    unsigned long stat_shed_connect;
+    unsigned long stat_shed_source;
+    unsigned long stat_tuned;
+    unsigned long long stat_redirected;
+    unsigned long stat_sockmap;
+    unsigned long stat_demoted;
+    unsigned long stat_deferred;
+    unsigned long stat_reclassified;
+    unsigned long stat_spins;
+    unsigned long stat_spin_hits;
+    unsigned long long stat_spin_usec;
+    unsigned long stat_profiled;
+    unsigned long stat_fastopen;
+    unsigned long long stat_early;
+    unsigned long stat_associations;
+    unsigned long long stat_datagrams;
+    unsigned long stat_udp_dropped;
+    unsigned long stat_udp_calls;
+    unsigned long hist_dispatch[LOOP_HIST_BUCKETS];
+    unsigned long hist_gap[LOOP_HIST_BUCKETS];
+    struct proxy_uring_t *uring;
+    struct proxy_sockmap_t *sockmap;
+    struct proxy_udp_t *udp;
+    struct flow_t *flows;
+    size_t flow_interactive;
+    size_t flow_bulk;
+    struct profile_t *profiles;
+    size_t profile_count;
+    unsigned char *stream_profiles;
+    struct source_t *sources;
+    size_t source_mask;
+    size_t source_used;
+    size_t source_tombs;
+    size_t source_rebuilt;
+    struct stream_t *stream_head[STREAM_LISTS];
+    struct stream_t *stream_tail[STREAM_LISTS];
+    struct stream_t *dirty_head;
+    struct stream_t *abandoned_head;
+    struct stream_t *free_head;
+    struct stream_t **slabs;
+    size_t slab_count;
+    struct queue_t *queue_free;
+    size_t queue_idle;
+    struct chunk_t **chunks;
+    struct chunk_t *chunk_free;
+    size_t chunk_idle;
+    struct pipe_t **pipes;
+    struct pipe_t *pipe_free;
+    size_t pipe_idle;
+    size_t ready_len;
+    size_t ready_start;
+    size_t budget;
+    size_t poll_len;
+    struct stream_t **ready;
+    struct stream_t **poll_streams;
+    struct pollfd *poll_list;
+    unsigned long long now;
+    unsigned long timer_tick;
+    struct stream_t *timer_wheel[TIMER_WHEEL_SIZE];
+    unsigned long long loop_wakeup;
+    unsigned long long loop_lag;
+    unsigned long long slow_usec;
+    int slow_fd;
+    int slow_role;
+    int slow_level;
+    char slow_host[256];
+    char dispatch_host[256];
 
     struct sockaddr_storage entrance;
+    int listen_fd;
 };
 
 /**
@@ -68,6 +248,11 @@ struct proxy_t
  */
 extern int proxy_task ( struct proxy_t *proxy );
 
+/**
+ * Run proxy task in worker processes
+ */
+extern int proxy_workers ( struct proxy_t *proxy );
+
 /**
  * Resolve hostname into IPv4 address
  */
@@ -7,10 +7,63 @@
 
 #define AXPROXY_VERSION             "1.05.1a"
 #define PROGRAM_SHORTCUT            "axpr"
-#define POOL_SIZE                   256
-#define LISTEN_BACKLOG              4
+#define STREAM_SLAB_SIZE            256
+#define CACHE_LINE_SIZE             64
+#define MAX_CONNS_LIMIT             4000000
+#define FD_RESERVED                 32
+#define EPOLL_BATCH                 1024
+#define WORKERS_LIMIT               64
+#define WORKER_RESPAWN_SEC          1
+#define LISTEN_BACKLOG              1024
+#define LISTEN_BACKLOG_LIMIT        65535
+#define DEFER_ACCEPT_LIMIT          3600
+#define FAST_OPEN_QUEUE             1024
+#define ACCEPT_BATCH                64
 #define POLL_TIMEOUT_MSEC           16000
-#define FORWARD_CHUNK_LEN           16384
+#define HANDSHAKE_TIMEOUT_MSEC      16000
+#define CONNECT_TIMEOUT_MSEC        16000
+#define IDLE_TIMEOUT_SEC            900
+#define IDLE_TIMEOUT_LIMIT          86400
+#define TIMER_TICK_MSEC             128
+#define TIMER_WHEEL_SIZE            512
+#define LOOP_STALL_MSEC             100
+#define LOOP_STALL_LIMIT            60000
+#define LOOP_HIST_BUCKETS           26
+#define SHED_OCCUPANCY_PCT          90
+#define SHED_LAG_MSEC               250
+#define SOURCE_CONNS_LIMIT          1000000
+#define SOURCE_RATE_LIMIT           100000
+#define SOURCE_PREFIX_V4            32
+#define SOURCE_PREFIX_V6            64
+#define SOURCE_TABLE_MIN            256
+#define TUNE_INTERVAL_TICKS         8
+#define TUNE_MEMORY_LIMIT           1048576
+#define TUNE_SNDBUF_MAX             16777216
+#define BUSY_POLL_LIMIT             10000
+#define BUSY_POLL_BUDGET            8
+#define PROFILE_LIMIT               16
+#define PROFILE_SIZE_LIMIT          1073741824
+#define FLOW_INTERVAL_TICKS         8
+#define FLOW_INTERACTIVE_BYTES      65536
+#define FLOW_INTERACTIVE_READ       1024
+#define UDP_BATCH                   64
+#define UDP_ROUNDS                  4
+#define UDP_DATAGRAM_MAX            8192
+#define UDP_SOCKET_BUFFER           1048576
+#define UDP_PEER_SLOTS              64
+#define UDP_PEER_PROBE              8
+#define SOCKMAP_STREAMS_LIMIT       65536
+#define SOCKMAP_BACKLOG_LIMIT       4194304
+#define FORWARD_CHUNK_LEN           65536
+#define FORWARD_CHUNK_MAX           1048576
+#define FORWARD_LOW_WATER_DIV       4
+#define FORWARD_QUANTUM             262144
+#define FORWARD_CHUNK_IDLE_LIMIT    64
 #define DATA_QUEUE_CAPACITY         384
+#define DATA_QUEUE_IDLE_LIMIT       64
+#define SPLICE_PIPE_LEN             262144
+#define SPLICE_PIPE_IDLE_LIMIT      64
+#define URING_ENTRIES               256
+#define URING_ACCEPT_QUEUE          1024
 
 #endif
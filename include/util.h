@@ -5,18 +5,29 @@
 #ifndef PROXY_UTIL_H
 #define PROXY_UTIL_H
 
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
 #include <arpa/inet.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <stddef.h>
 #include <poll.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/epoll.h>
 #include <sys/ioctl.h>
+#include <sys/resource.h>
 #include <sys/socket.h>
 #include <stdint.h>
+#include <time.h>
 #include <unistd.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <linux/filter.h>
+#include <linux/sockios.h>
 
 #ifndef UNUSED
 #define UNUSED(x) (void)(x)
@@ -28,12 +39,21 @@
  * Constants Definitions
  */
 #define S_INVALID                   -1
+#define L_ACCEPT                    0
 #define S_PORT_A                    100
 #define S_PORT_B                    200
+#define S_PORT_U                    300
 #define LEVEL_NONE                  0
 #define LEVEL_CONNECTING            111
 #define LEVEL_FORWARDING            123
+#define LEVEL_ASSOCIATED            124
 #define EPOLLREF                    ((struct pollfd*) -1)
+#define LIST_OTHER                  0
+#define LIST_HANDSHAKE              1
+#define LIST_CONNECTING             2
+#define LIST_ESTABLISHED            3
+#define STREAM_LISTS                4
+#define STREAM_INDEX_MASK           0xffffff
 #define STRADDR_SIZE                (INET_ADDRSTRLEN + INET6_ADDRSTRLEN + 16)
 
 /**
@@ -69,11 +89,66 @@
 
 #ifdef PROXY_UTIL_BASE_STRUCTS
 
+/**
+ * Relay chunk structure
+ */
+struct chunk_t
+{
+    struct chunk_t *next;
+    size_t off;
+    size_t len;
+    size_t size;
+    int eof;
+    uint8_t arr[];
+};
+
+/**
+ * Splice relay pipe structure
+ */
+struct pipe_t
+{
+    struct pipe_t *next;
+    int fd[2];
+    size_t len;
+    size_t size;
+};
+
+/**
+ * io_uring backend state
+ */
+struct proxy_uring_t;
+
+/**
+ * Kernel relay state
+ */
+struct proxy_sockmap_t;
+
+/**
+ * Relation traffic class entry
+ */
+struct flow_t;
+
+/**
+ * UDP association batch state
+ */
+struct proxy_udp_t;
+
+/**
+ * Destination socket profile
+ */
+struct profile_t;
+
+/**
+ * Client source address table entry
+ */
+struct source_t;
+
 /**
  * Data queue structure
  */
 struct queue_t
 {
+    struct queue_t *next;
     size_t len;
     uint8_t arr[DATA_QUEUE_CAPACITY];
 };
@@ -83,20 +158,40 @@ struct queue_t
  */
 struct stream_t
 {
-    int role;
+    /* Hot fields fit the first cache line */
     int fd;
-    int level;
-    int allocated;
-    int abandoned;
     short events;
     short levents;
     short revents;
+    short readiness;
+    short role;
+    short level;
+    unsigned int generation;
+    unsigned int index;
+    unsigned char allocated;
+    unsigned char abandoned;
+    unsigned char dirty;
+    unsigned char list;
+    unsigned int source;
 
-    struct pollfd *pollref;
     struct stream_t *neighbour;
+    struct pollfd *pollref;
+    struct stream_t *dirty_next;
+    struct queue_t *queue;
+
+    /* Cold fields follow */
     struct stream_t *prev;
     struct stream_t *next;
-    struct queue_t queue;
+    struct stream_t *abandoned_next;
+    struct stream_t *timer_next;
+    struct stream_t **timer_link;
+    struct stream_t **dirty_link;
+    unsigned int deadline;
+    unsigned int ready_slot;
+    unsigned int active;
+    unsigned int relay_len;
+    unsigned int sndbuf;
+    unsigned long long bytes;
 
     /* additional params here */
 };
@@ -109,9 +204,108 @@ struct proxy_t
     size_t stream_size;
     int verbose;
     int epoll_fd;
-    struct stream_t *stream_head;
-    struct stream_t *stream_tail;
-    struct stream_t stream_pool[POOL_SIZE];
+    int workers;
+    int worker_id;
+    int worker_cpu;
+    int cpu_pinning;
+    int edge_triggered;
+    int io_uring;
+    int splice;
+    int kernel_relay;
+    int prioritize;
+    int interactive_tos;
+    long busy_poll;
+    int fast_open;
+    size_t max_conns;
+    long idle_timeout;
+    int listen_backlog;
+    int defer_accept;
+    long stall_threshold;
+    int shed_occupancy;
+    long shed_lag;
+    long source_conns;
+    long source_rate;
+    size_t tune_limit;
+    size_t tune_used;
+    size_t stream_limit;
+    size_t stream_total;
+    size_t stream_count;
+    unsigned long stat_accepted;
+    unsigned long stat_relations;
+    unsigned long stat_cpu_local;
+    unsigned long stat_epoll_ctl;
+    unsigned long stat_uring_enter;
+    unsigned long long stat_forwarded;
+    unsigned long long stat_spliced;
+    unsigned long stat_stalls;
+    unsigned long stat_shed_accept;
+    unsigned long stat_shed_connect;
+    unsigned long stat_shed_source;
+    unsigned long stat_tuned;
+    unsigned long long stat_redirected;
+    unsigned long stat_sockmap;
+    unsigned long stat_demoted;
+    unsigned long stat_deferred;
+    unsigned long stat_reclassified;
+    unsigned long stat_spins;
+    unsigned long stat_spin_hits;
+    unsigned long long stat_spin_usec;
+    unsigned long stat_profiled;
+    unsigned long stat_fastopen;
+    unsigned long long stat_early;
+    unsigned long stat_associations;
+    unsigned long long stat_datagrams;
+    unsigned long stat_udp_dropped;
+    unsigned long stat_udp_calls;
+    unsigned long hist_dispatch[LOOP_HIST_BUCKETS];
+    unsigned long hist_gap[LOOP_HIST_BUCKETS];
+    struct proxy_uring_t *uring;
+    struct proxy_sockmap_t *sockmap;
+    struct proxy_udp_t *udp;
+    struct flow_t *flows;
+    size_t flow_interactive;
+    size_t flow_bulk;
+    struct profile_t *profiles;
+    size_t profile_count;
+    unsigned char *stream_profiles;
+    struct source_t *sources;
+    size_t source_mask;
+    size_t source_used;
+    size_t source_tombs;
+    size_t source_rebuilt;
+    struct stream_t *stream_head[STREAM_LISTS];
+    struct stream_t *stream_tail[STREAM_LISTS];
+    struct stream_t *dirty_head;
+    struct stream_t *abandoned_head;
+    struct stream_t *free_head;
+    struct stream_t **slabs;
+    size_t slab_count;
+    struct queue_t *queue_free;
+    size_t queue_idle;
+    struct chunk_t **chunks;
+    struct chunk_t *chunk_free;
+    size_t chunk_idle;
+    struct pipe_t **pipes;
+    struct pipe_t *pipe_free;
+    size_t pipe_idle;
+    size_t ready_len;
+    size_t ready_start;
+    size_t budget;
+    size_t poll_len;
+    struct stream_t **ready;
+    struct stream_t **poll_streams;
+    struct pollfd *poll_list;
+    unsigned long long now;
+    unsigned long timer_tick;
+    struct stream_t *timer_wheel[TIMER_WHEEL_SIZE];
+    unsigned long long loop_wakeup;
+    unsigned long long loop_lag;
+    unsigned long long slow_usec;
+    int slow_fd;
+    int slow_role;
+    int slow_level;
+    char slow_host[256];
+    char dispatch_host[256];
 
     /* additional params here */
 };
@@ -121,6 +315,16 @@ struct proxy_t
  */
 extern int handle_stream_events ( struct proxy_t *proxy, struct stream_t *stream );
 
+/**
+ * Describe stream stage
+ */
+extern const char *stream_stage ( int role, int level );
+
+/**
+ * Resolve hostname into IPv4 address
+ */
+extern int nsaddr_cached ( const char *hostname, uint32_t * addr );
+
 #endif
 /* ------------------------------------------------------------------
  * Proxy Util - Source File
@@ -147,35 +351,81 @@ extern void format_ip_port ( const struct sockaddr_storage *saddr, char *buffer,
 /**
  * Connect remote endpoint asynchronously
  */
-extern int connect_async ( struct proxy_t *proxy, const struct sockaddr_storage *saddr );
+extern int connect_async ( struct proxy_t *proxy, const struct sockaddr_storage *saddr,
+    const uint8_t * data, size_t *len );
 
 /**
  * Bind address to listen socket
  */
 extern int listen_socket ( struct proxy_t *proxy, const struct sockaddr_storage *saddr );
 
+/**
+ * Steer listen socket group connections by incoming CPU
+ */
+extern int listen_socket_steer_cpu ( struct proxy_t *proxy, int sock, const int *cpus,
+    int groups );
+
 /**
  * Check for socket error
  */
 extern int socket_has_error ( int sock );
 
+/**
+ * Get count of bytes given to the socket for sending so far
+ */
+extern int socket_bytes_written ( int sock, unsigned long long *bytes );
+
 /**
  * Set socket non-blocking mode
  */
 extern int socket_set_nonblocking ( struct proxy_t *proxy, int sock );
 
 /**
- * Forward data between sockets
+ * Let socket reads busy poll the device queue
  */
-extern int socket_forward_data ( struct proxy_t *proxy, int srcfd, int dstfd );
+extern void socket_set_busy_poll ( struct proxy_t *proxy, int sock );
 
 /**
  * Shutdown and close the socket
  */
 extern void shutdown_then_close ( struct proxy_t *proxy, int sock );
 
+/* NOTE: Splice Pipe Related Functions */
+
+/**
+ * Take splice pipe for the stream data
+ */
+extern struct pipe_t *pipe_acquire ( struct proxy_t *proxy, struct stream_t *stream );
+
+/**
+ * Return drained splice pipe to the pool
+ */
+extern void pipe_release ( struct proxy_t *proxy, struct stream_t *stream );
+
+/* NOTE: Relay Chunk Related Functions */
+
+/**
+ * Take relay chunk for the stream backlog
+ */
+extern struct chunk_t *chunk_acquire ( struct proxy_t *proxy, struct stream_t *stream );
+
+/**
+ * Return relay chunk to the pool
+ */
+extern void chunk_release ( struct proxy_t *proxy, struct stream_t *stream );
+
 /* NOTE: Data Queue Related Functions */
 
+/**
+ * Take data queue for the stream handshake
+ */
+extern struct queue_t *queue_acquire ( struct proxy_t *proxy, struct stream_t *stream );
+
+/**
+ * Return stream data queue to the pool
+ */
+extern void queue_release ( struct proxy_t *proxy, struct stream_t *stream );
+
 /**
  * Reset data queue content
  */
@@ -211,12 +461,12 @@ extern int proxy_events_setup ( struct proxy_t *proxy );
 /**
  * Build stream event list with poll
  */
-extern int build_poll_list ( struct proxy_t *proxy, struct pollfd *poll_list, size_t *poll_len );
+extern int build_poll_list ( struct proxy_t *proxy );
 
 /**
  * Update streams revents with poll
  */
-extern void update_revents_poll ( struct proxy_t *proxy );
+extern void update_revents_poll ( struct proxy_t *proxy, int nfds );
 
 /**
  * Watch stream events with poll
@@ -253,23 +503,347 @@ extern int watch_streams_epoll ( struct proxy_t *proxy );
  */
 extern int watch_streams ( struct proxy_t *proxy );
 
+/**
+ * Release proxy events listenning
+ */
+extern void proxy_events_cleanup ( struct proxy_t *proxy );
+
+/* NOTE: io_uring Related Functions */
+
+/**
+ * Setup io_uring instance
+ */
+extern int uring_setup ( struct proxy_t *proxy );
+
+/**
+ * Release io_uring instance
+ */
+extern void uring_free ( struct proxy_t *proxy );
+
+/**
+ * Cancel stream requests, then shutdown and close its socket
+ */
+extern int uring_remove_stream ( struct proxy_t *proxy, struct stream_t *stream );
+
+/**
+ * Take a socket accepted by multishot accept
+ */
+extern int uring_accept ( struct proxy_t *proxy );
+
+/**
+ * Watch stream events with io_uring
+ */
+extern int watch_streams_uring ( struct proxy_t *proxy );
+
+/* NOTE: Relation Class Related Functions */
+
+/**
+ * Setup relation class table sized by streams limit
+ */
+extern int flow_table_setup ( struct proxy_t *proxy );
+
+/**
+ * Release relation class table
+ */
+extern void flow_table_free ( struct proxy_t *proxy );
+
+/**
+ * Start tracking relation, taken as interactive until it moves volume
+ */
+extern void flow_start ( struct proxy_t *proxy, struct stream_t *relation );
+
+/**
+ * Stop tracking relation
+ */
+extern void flow_release ( struct proxy_t *proxy, struct stream_t *stream );
+
+/**
+ * Count data read from the relation stream
+ */
+extern void flow_count_read ( struct proxy_t *proxy, struct stream_t *stream );
+
+/**
+ * Classify relation by traffic since the window start
+ */
+extern void flow_classify ( struct proxy_t *proxy, struct stream_t *relation, int window_end );
+
+/**
+ * Check if stream belongs to an interactive relation
+ */
+extern int flow_interactive ( struct proxy_t *proxy, const struct stream_t *stream );
+
+/* NOTE: Socket Profile Related Functions */
+
+/**
+ * Add profile from destination and settings, comma separated
+ */
+extern int profile_add ( struct proxy_t *proxy, const char *spec );
+
+/**
+ * Setup relation profile table sized by streams limit
+ */
+extern int profile_table_setup ( struct proxy_t *proxy );
+
+/**
+ * Release relation profile table
+ */
+extern void profile_table_free ( struct proxy_t *proxy );
+
+/**
+ * Find first profile matching the destination, -1 if none
+ */
+extern int profile_match ( struct proxy_t *proxy, const struct sockaddr_storage *saddr );
+
+/**
+ * Set socket options of the profile
+ */
+extern void profile_apply ( struct proxy_t *proxy, int index, int sock );
+
+/**
+ * Apply destination profile to the client side of new relation
+ */
+extern void profile_start ( struct proxy_t *proxy, struct stream_t *relation,
+    const struct sockaddr_storage *saddr );
+
+/**
+ * Check if profile of the relation asks for no delay
+ */
+extern int profile_nodelay ( struct proxy_t *proxy, const struct stream_t *relation );
+
+/* NOTE: UDP Association Related Functions */
+
+/**
+ * Create association socket next to the control connection, reply address goes to saddr
+ */
+extern int udp_associate ( struct proxy_t *proxy, struct stream_t *stream, uint16_t port,
+    struct sockaddr_storage *saddr );
+
+/**
+ * Release association state
+ */
+extern void udp_release ( struct proxy_t *proxy, struct stream_t *stream );
+
+/**
+ * Release datagram batch buffers
+ */
+extern void udp_free ( struct proxy_t *proxy );
+
+/**
+ * Handle events of association or its control connection
+ */
+extern int udp_handle_events ( struct proxy_t *proxy, struct stream_t *stream );
+
+/* NOTE: Kernel Relay Related Functions */
+
+/**
+ * Setup kernel relay maps and verdict program
+ */
+extern int sockmap_setup ( struct proxy_t *proxy );
+
+/**
+ * Release kernel relay maps and verdict program
+ */
+extern void sockmap_free ( struct proxy_t *proxy );
+
+/**
+ * Hand relation over to kernel relay
+ */
+extern int sockmap_attach ( struct proxy_t *proxy, struct stream_t *stream );
+
+/**
+ * Get kernel relayed data not yet given to the stream socket
+ */
+extern size_t sockmap_backlog ( struct proxy_t *proxy, struct stream_t *stream );
+
+/**
+ * Check if the stream socket is in the sockmap
+ */
+extern int sockmap_mapped ( struct proxy_t *proxy, const struct stream_t *stream );
+
+/**
+ * Take stream out of kernel relay
+ */
+extern void sockmap_release ( struct proxy_t *proxy, struct stream_t *stream );
+
+/**
+ * Get count of relations in kernel relay
+ */
+extern size_t sockmap_relations ( struct proxy_t *proxy );
+
+/**
+ * Account kernel relayed data and handle congested relations
+ */
+extern void sockmap_sweep ( struct proxy_t *proxy );
+
+/* NOTE: Timer Related Functions */
+
+/**
+ * Update cached monotonic clock
+ */
+extern void proxy_clock_update ( struct proxy_t *proxy );
+
+/**
+ * Arm stream timer to expire after given time
+ */
+extern void stream_set_timer ( struct proxy_t *proxy, struct stream_t *stream,
+    unsigned long msec );
+
+/**
+ * Disarm stream timer
+ */
+extern void stream_clear_timer ( struct proxy_t *proxy, struct stream_t *stream );
+
+/**
+ * Get events wait timeout until the next timer
+ */
+extern int timer_wait_msec ( struct proxy_t *proxy );
+
+/**
+ * Expire stream timers due
+ */
+extern void expire_timers ( struct proxy_t *proxy );
+
+/* NOTE: Loop Monitoring Related Functions */
+
+/**
+ * Record loop wakeup
+ */
+extern void loop_wakeup ( struct proxy_t *proxy );
+
+/**
+ * Record single stream dispatch time
+ */
+extern void loop_stream_done ( struct proxy_t *proxy, int fd, int role, int level,
+    unsigned long long start );
+
+/**
+ * Record loop dispatch time and report stalls
+ */
+extern void loop_dispatched ( struct proxy_t *proxy );
+
+/**
+ * Get monotonic time in microseconds
+ */
+extern unsigned long long monotonic_usec ( void );
+
+/* NOTE: Admission Related Functions */
+
+/**
+ * Check if loop lags too much to take new clients
+ */
+extern int admission_lagging ( struct proxy_t *proxy );
+
+/**
+ * Check if stream pool is too crowded for new relations
+ */
+extern int admission_crowded ( struct proxy_t *proxy );
+
+/* NOTE: Source Table Related Functions */
+
+/**
+ * Setup client source table sized by connections limit
+ */
+extern int source_table_setup ( struct proxy_t *proxy );
+
+/**
+ * Release client source table
+ */
+extern void source_table_free ( struct proxy_t *proxy );
+
+/**
+ * Account new client in its source entry, fail if over the limits
+ */
+extern int source_admit ( struct proxy_t *proxy, struct stream_t *stream,
+    const struct sockaddr_storage *saddr );
+
+/**
+ * Release client from its source entry
+ */
+extern void source_release ( struct proxy_t *proxy, struct stream_t *stream );
+
 /* NOTE: Stream Related Functions */
 
+/**
+ * Setup stream pool sized by connections limit
+ */
+extern int stream_pool_setup ( struct proxy_t *proxy );
+
+/**
+ * Release stream pool
+ */
+extern void stream_pool_free ( struct proxy_t *proxy );
+
+/**
+ * Encode stream slot index and generation
+ */
+extern uint64_t stream_ref ( const struct stream_t *stream );
+
+/**
+ * Decode stream reference into a live stream
+ */
+extern struct stream_t *stream_lookup ( struct proxy_t *proxy, uint64_t ref );
+
+/**
+ * Queue stream for the next events list flush
+ */
+extern void stream_set_dirty ( struct proxy_t *proxy, struct stream_t *stream );
+
+/**
+ * Take next stream from the dirty list
+ */
+extern struct stream_t *stream_pop_dirty ( struct proxy_t *proxy );
+
+/**
+ * Queue stream for dispatch in this cycle
+ */
+extern void stream_set_ready ( struct proxy_t *proxy, struct stream_t *stream );
+
+/**
+ * Update stream events interest
+ */
+extern void stream_set_events ( struct proxy_t *proxy, struct stream_t *stream, short events );
+
+/**
+ * Check if stream is watched in edge-triggered mode
+ */
+extern int stream_edge_triggered ( struct proxy_t *proxy, const struct stream_t *stream );
+
+/**
+ * Clear stream readiness after it would block
+ */
+extern void stream_clear_ready ( struct stream_t *stream, short events );
+
+/**
+ * Move stream to the head of a stream list, least recent stay at the tail
+ */
+extern void stream_set_list ( struct proxy_t *proxy, struct stream_t *stream, int list );
+
 /**
  * Insert new stream structure into the list
  */
 extern struct stream_t *insert_stream ( struct proxy_t *proxy, int sock );
 
+/**
+ * Check if accept failed only for lack of pending connections
+ */
+extern int accept_would_block ( int err );
+
 /**
  * Accept a new stream
  */
-extern struct stream_t *accept_new_stream ( struct proxy_t *proxy, int lfd );
+extern struct stream_t *accept_new_stream ( struct proxy_t *proxy, int lfd,
+    struct sockaddr_storage *saddr );
 
 /**
  * Handle stream data forward
  */
 extern int handle_forward_data ( struct proxy_t *proxy, struct stream_t *stream );
 
+/**
+ * Resume stream data forward held back without events
+ */
+extern int resume_forward_data ( struct proxy_t *proxy, struct stream_t *stream );
+
 /**
  * Show relations statistics
  */
@@ -283,7 +857,7 @@ extern void remove_stream ( struct proxy_t *proxy, struct stream_t *stream );
 /*
  * Abandon associated pair of streams
  */
-extern void remove_relation ( struct stream_t *stream );
+extern void remove_relation ( struct proxy_t *proxy, struct stream_t *stream );
 
 /**
  * Remove all relations
@@ -0,0 +1,277 @@
+/* ------------------------------------------------------------------
+ * Proxy Util - Relation Latency Classes
+ * ------------------------------------------------------------------ */
+
+#define PROXY_UTIL_BASE_STRUCTS
+#include "util.h"
+
+/**
+ * Relation classes
+ */
+#define FLOW_NONE                   0
+#define FLOW_INTERACTIVE            1
+#define FLOW_BULK                   2
+
+/**
+ * Linux traffic control priority of interactive traffic
+ */
+#define FLOW_PRIO_INTERACTIVE       6
+
+/**
+ * Window ends before interactive class is trusted, the first may be partial
+ */
+#define FLOW_CONFIRM_WINDOWS        2
+
+/**
+ * Relation traffic in the current window
+ */
+struct flow_t
+{
+    unsigned long long mark;
+    unsigned int reads;
+    unsigned char class;
+    unsigned char windows;
+};
+
+/**
+ * Setup relation class table sized by streams limit
+ */
+int flow_table_setup ( struct proxy_t *proxy )
+{
+    proxy->flows = NULL;
+    proxy->flow_interactive = 0;
+    proxy->flow_bulk = 0;
+
+    if ( !proxy->prioritize )
+    {
+        return 0;
+    }
+
+    if ( !( proxy->flows = ( struct flow_t * ) calloc ( proxy->stream_limit,
+                sizeof ( struct flow_t ) ) ) )
+    {
+        return -1;
+    }
+
+    verbose ( "relation class table setup for %lu stream(s)\n",
+        ( unsigned long ) proxy->stream_limit );
+
+    return 0;
+}
+
+/**
+ * Release relation class table
+ */
+void flow_table_free ( struct proxy_t *proxy )
+{
+    free ( proxy->flows );
+    proxy->flows = NULL;
+    proxy->flow_interactive = 0;
+    proxy->flow_bulk = 0;
+}
+
+/**
+ * Set socket options of the relation class
+ */
+static void flow_set_socket ( struct proxy_t *proxy, int sock, int interactive, int nodelay )
+{
+    int value;
+    int domain;
+    socklen_t len;
+
+    /* Small writes go out at once */
+    value = nodelay;
+    if ( setsockopt ( sock, IPPROTO_TCP, TCP_NODELAY, &value, sizeof ( value ) ) < 0 )
+    {
+        verbose ( "cannot set socket:%i nodelay (%i)\n", sock, errno );
+    }
+
+    if ( !proxy->interactive_tos )
+    {
+        return;
+    }
+
+    len = sizeof ( domain );
+    if ( getsockopt ( sock, SOL_SOCKET, SO_DOMAIN, &domain, &len ) < 0 )
+    {
+        return;
+    }
+
+    /* Setting TOS resets priority, so priority goes last */
+    value = interactive ? proxy->interactive_tos : 0;
+    if ( ( domain == AF_INET6
+            ? setsockopt ( sock, IPPROTO_IPV6, IPV6_TCLASS, &value, sizeof ( value ) )
+            : setsockopt ( sock, IPPROTO_IP, IP_TOS, &value, sizeof ( value ) ) ) < 0 )
+    {
+        verbose ( "cannot set socket:%i tos (%i)\n", sock, errno );
+    }
+
+    value = interactive ? FLOW_PRIO_INTERACTIVE : 0;
+    if ( setsockopt ( sock, SOL_SOCKET, SO_PRIORITY, &value, sizeof ( value ) ) < 0 )
+    {
+        verbose ( "cannot set socket:%i priority (%i)\n", sock, errno );
+    }
+}
+
+/**
+ * Move relation to the class
+ */
+static void flow_set_class ( struct proxy_t *proxy, struct stream_t *relation, int class )
+{
+    int nodelay;
+    struct flow_t *flow = proxy->flows + relation->index;
+
+    if ( flow->class == FLOW_INTERACTIVE )
+    {
+        proxy->flow_interactive--;
+
+    } else if ( flow->class == FLOW_BULK )
+    {
+        proxy->flow_bulk--;
+    }
+
+    if ( class == FLOW_INTERACTIVE )
+    {
+        proxy->flow_interactive++;
+
+    } else
+    {
+        proxy->flow_bulk++;
+    }
+
+    flow->class = class;
+    flow->windows = 0;
+
+    /* Destination profile may keep no delay for bulk too */
+    nodelay = class == FLOW_INTERACTIVE || profile_nodelay ( proxy, relation );
+    flow_set_socket ( proxy, relation->fd, class == FLOW_INTERACTIVE, nodelay );
+    flow_set_socket ( proxy, relation->neighbour->fd, class == FLOW_INTERACTIVE, nodelay );
+
+    verbose ( "relation with socket:%i is %s\n", relation->fd,
+        class == FLOW_INTERACTIVE ? "interactive" : "bulk" );
+}
+
+/**
+ * Start tracking relation, taken as interactive until it moves volume
+ */
+void flow_start ( struct proxy_t *proxy, struct stream_t *relation )
+{
+    struct flow_t *flow = proxy->flows + relation->index;
+
+    flow->mark = relation->bytes;
+    flow->reads = 0;
+    flow_set_class ( proxy, relation, FLOW_INTERACTIVE );
+}
+
+/**
+ * Stop tracking relation
+ */
+void flow_release ( struct proxy_t *proxy, struct stream_t *stream )
+{
+    struct flow_t *flow = proxy->flows + stream->index;
+
+    if ( flow->class == FLOW_INTERACTIVE )
+    {
+        proxy->flow_interactive--;
+
+    } else if ( flow->class == FLOW_BULK )
+    {
+        proxy->flow_bulk--;
+    }
+
+    flow->class = FLOW_NONE;
+}
+
+/**
+ * Count data read from the relation stream
+ */
+void flow_count_read ( struct proxy_t *proxy, struct stream_t *stream )
+{
+    int value = 1;
+    struct flow_t *flow;
+
+    flow = proxy->flows + ( stream->role == S_PORT_B ? stream : stream->neighbour )->index;
+    flow->reads++;
+
+    /* Quick ack mode ends by itself, renewed after each read once class is confirmed */
+    if ( flow->windows >= FLOW_CONFIRM_WINDOWS
+        && setsockopt ( stream->fd, IPPROTO_TCP, TCP_QUICKACK, &value, sizeof ( value ) ) < 0 )
+    {
+        verbose ( "cannot set socket:%i quick ack (%i)\n", stream->fd, errno );
+    }
+}
+
+/**
+ * Classify relation by traffic since the window start
+ */
+void flow_classify ( struct proxy_t *proxy, struct stream_t *relation, int window_end )
+{
+    int class;
+    unsigned long long bytes;
+    struct flow_t *flow = proxy->flows + relation->index;
+
+    if ( flow->class == FLOW_NONE )
+    {
+        return;
+    }
+
+    bytes = relation->bytes - flow->mark;
+
+    /* Volume over the limit turns the relation bulk at once */
+    if ( bytes > FLOW_INTERACTIVE_BYTES )
+    {
+        class = FLOW_BULK;
+
+    } else if ( !window_end )
+    {
+        return;
+
+    } else
+    {
+        /* Low volume in small reads is interactive */
+        class = bytes <= ( unsigned long long ) flow->reads * FLOW_INTERACTIVE_READ
+            ? FLOW_INTERACTIVE : FLOW_BULK;
+    }
+
+    if ( class != flow->class )
+    {
+        flow_set_class ( proxy, relation, class );
+        proxy->stat_reclassified++;
+
+    } else if ( !window_end )
+    {
+        return;
+    }
+
+    /* Interactive class counts window ends until it is confirmed */
+    if ( window_end && class == FLOW_INTERACTIVE && flow->windows < FLOW_CONFIRM_WINDOWS )
+    {
+        flow->windows++;
+    }
+
+    flow->mark = relation->bytes;
+    flow->reads = 0;
+}
+
+/**
+ * Check if stream belongs to an interactive relation
+ */
+int flow_interactive ( struct proxy_t *proxy, const struct stream_t *stream )
+{
+    const struct stream_t *relation;
+
+    if ( stream->role == S_PORT_B )
+    {
+        relation = stream;
+
+    } else if ( stream->role == S_PORT_A && stream->neighbour )
+    {
+        relation = stream->neighbour;
+
+    } else
+    {
+        return 0;
+    }
+
+    return proxy->flows[relation->index].class == FLOW_INTERACTIVE;
+}
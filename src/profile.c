@@ -0,0 +1,409 @@
+/* ------------------------------------------------------------------
+ * Proxy Util - Destination Socket Profiles
+ * ------------------------------------------------------------------ */
+
+#define PROXY_UTIL_BASE_STRUCTS
+#include "util.h"
+
+/**
+ * Congestion control name length with terminator
+ */
+#define PROFILE_CC_SIZE             16
+
+/**
+ * Destination socket profile
+ */
+struct profile_t
+{
+    unsigned char family;
+    unsigned char bits;
+    uint8_t addr[16];
+    unsigned short port;
+    int nodelay;
+    int lowat;
+    int sndbuf;
+    int rcvbuf;
+    char congestion[PROFILE_CC_SIZE];
+};
+
+/**
+ * Parse profile size setting
+ */
+static int profile_parse_size ( const char *str, int *value )
+{
+    long result;
+    char *end;
+
+    errno = 0;
+    result = strtol ( str, &end, 10 );
+
+    if ( errno || end == str || *end || result < 1 || result > PROFILE_SIZE_LIMIT )
+    {
+        return -1;
+    }
+
+    *value = result;
+    return 0;
+}
+
+/**
+ * Parse profile destination, port or address with optional prefix length
+ */
+static int profile_parse_match ( struct profile_t *profile, char *str )
+{
+    long value;
+    char *end;
+    char *slash;
+
+    /* Any destination */
+    if ( !strcmp ( str, "*" ) )
+    {
+        return 0;
+    }
+
+    /* Destination port */
+    if ( !strchr ( str, '.' ) && !strchr ( str, ':' ) )
+    {
+        errno = 0;
+        value = strtol ( str, &end, 10 );
+        if ( errno || end == str || *end || value < 1 || value > 65535 )
+        {
+            return -1;
+        }
+        profile->port = value;
+        return 0;
+    }
+
+    /* Destination network */
+    if ( ( slash = strchr ( str, '/' ) ) )
+    {
+        *slash++ = '\0';
+    }
+
+    if ( inet_pton ( AF_INET, str, profile->addr ) > 0 )
+    {
+        profile->family = 4;
+        profile->bits = 32;
+
+    } else if ( inet_pton ( AF_INET6, str, profile->addr ) > 0 )
+    {
+        profile->family = 6;
+        profile->bits = 128;
+
+    } else
+    {
+        return -1;
+    }
+
+    if ( slash )
+    {
+        errno = 0;
+        value = strtol ( slash, &end, 10 );
+        if ( errno || end == slash || *end || value < 0 || value > profile->bits )
+        {
+            return -1;
+        }
+        profile->bits = value;
+    }
+
+    return 0;
+}
+
+/**
+ * Check if congestion control can be set on sockets
+ */
+static int profile_check_congestion ( const char *name )
+{
+    int sock;
+    int status;
+
+    if ( ( sock = socket ( AF_INET, SOCK_STREAM, 0 ) ) < 0 )
+    {
+        return -1;
+    }
+
+    status = setsockopt ( sock, IPPROTO_TCP, TCP_CONGESTION, name, strlen ( name ) );
+    close ( sock );
+
+    return status;
+}
+
+/**
+ * Parse profile setting
+ */
+static int profile_parse_setting ( struct profile_t *profile, const char *str )
+{
+    if ( !strcmp ( str, "nodelay" ) )
+    {
+        profile->nodelay = 1;
+        return 0;
+    }
+
+    if ( !strncmp ( str, "lowat=", 6 ) )
+    {
+        return profile_parse_size ( str + 6, &profile->lowat );
+    }
+
+    if ( !strncmp ( str, "sndbuf=", 7 ) )
+    {
+        return profile_parse_size ( str + 7, &profile->sndbuf );
+    }
+
+    if ( !strncmp ( str, "rcvbuf=", 7 ) )
+    {
+        return profile_parse_size ( str + 7, &profile->rcvbuf );
+    }
+
+    if ( !strncmp ( str, "cc=", 3 ) )
+    {
+        if ( !str[3] || strlen ( str + 3 ) >= sizeof ( profile->congestion ) )
+        {
+            return -1;
+        }
+
+        if ( profile_check_congestion ( str + 3 ) < 0 )
+        {
+            failure ( "congestion control %s is not available (%i)\n", str + 3, errno );
+            return -1;
+        }
+
+        strcpy ( profile->congestion, str + 3 );
+        return 0;
+    }
+
+    return -1;
+}
+
+/**
+ * Add profile from destination and settings, comma separated
+ */
+int profile_add ( struct proxy_t *proxy, const char *spec )
+{
+    char *str;
+    char *token;
+    char *saveptr;
+    struct profile_t profile;
+    struct profile_t *profiles;
+
+    if ( proxy->profile_count >= PROFILE_LIMIT )
+    {
+        return -1;
+    }
+
+    if ( !( str = strdup ( spec ) ) )
+    {
+        return -1;
+    }
+
+    memset ( &profile, '\0', sizeof ( profile ) );
+
+    /* Destination goes first, at least one setting follows */
+    if ( !( token = strtok_r ( str, ",", &saveptr ) )
+        || profile_parse_match ( &profile, token ) < 0
+        || !( token = strtok_r ( NULL, ",", &saveptr ) ) )
+    {
+        free ( str );
+        return -1;
+    }
+
+    do
+    {
+        if ( profile_parse_setting ( &profile, token ) < 0 )
+        {
+            free ( str );
+            return -1;
+        }
+
+    } while ( ( token = strtok_r ( NULL, ",", &saveptr ) ) );
+
+    free ( str );
+
+    if ( !( profiles = ( struct profile_t * ) realloc ( proxy->profiles,
+                ( proxy->profile_count + 1 ) * sizeof ( struct profile_t ) ) ) )
+    {
+        return -1;
+    }
+
+    profiles[proxy->profile_count++] = profile;
+    proxy->profiles = profiles;
+
+    return 0;
+}
+
+/**
+ * Setup relation profile table sized by streams limit
+ */
+int profile_table_setup ( struct proxy_t *proxy )
+{
+    proxy->stream_profiles = NULL;
+
+    if ( !proxy->profile_count )
+    {
+        return 0;
+    }
+
+    if ( !( proxy->stream_profiles = ( unsigned char * ) calloc ( proxy->stream_limit,
+                sizeof ( unsigned char ) ) ) )
+    {
+        return -1;
+    }
+
+    verbose ( "relation profile table setup with %lu profile(s)\n",
+        ( unsigned long ) proxy->profile_count );
+
+    return 0;
+}
+
+/**
+ * Release relation profile table
+ */
+void profile_table_free ( struct proxy_t *proxy )
+{
+    free ( proxy->stream_profiles );
+    proxy->stream_profiles = NULL;
+}
+
+/**
+ * Check if destination address is in the profile network
+ */
+static int profile_match_addr ( const struct profile_t *profile, const uint8_t * addr )
+{
+    unsigned int bytes = profile->bits / 8;
+    unsigned int rest = profile->bits % 8;
+
+    if ( memcmp ( profile->addr, addr, bytes ) )
+    {
+        return 0;
+    }
+
+    return !rest || !( ( profile->addr[bytes] ^ addr[bytes] ) & ( 0xff << ( 8 - rest ) ) );
+}
+
+/**
+ * Find first profile matching the destination, -1 if none
+ */
+int profile_match ( struct proxy_t *proxy, const struct sockaddr_storage *saddr )
+{
+    size_t i;
+    unsigned char family;
+    unsigned short port;
+    const uint8_t *addr;
+    const struct profile_t *profile;
+
+    if ( saddr->ss_family == AF_INET )
+    {
+        family = 4;
+        addr = ( const uint8_t * ) &( ( const struct sockaddr_in * ) saddr )->sin_addr;
+        port = ntohs ( ( ( const struct sockaddr_in * ) saddr )->sin_port );
+
+    } else if ( saddr->ss_family == AF_INET6 )
+    {
+        addr = ( ( const struct sockaddr_in6 * ) saddr )->sin6_addr.s6_addr;
+        port = ntohs ( ( ( const struct sockaddr_in6 * ) saddr )->sin6_port );
+
+        /* IPv4-mapped destinations match IPv4 networks */
+        if ( IN6_IS_ADDR_V4MAPPED ( &( ( const struct sockaddr_in6 * ) saddr )->sin6_addr ) )
+        {
+            family = 4;
+            addr += 12;
+
+        } else
+        {
+            family = 6;
+        }
+
+    } else
+    {
+        return -1;
+    }
+
+    for ( i = 0; i < proxy->profile_count; i++ )
+    {
+        profile = proxy->profiles + i;
+
+        if ( ( !profile->port || profile->port == port )
+            && ( !profile->family || ( profile->family == family
+                    && profile_match_addr ( profile, addr ) ) ) )
+        {
+            return i;
+        }
+    }
+
+    return -1;
+}
+
+/**
+ * Set socket options of the profile
+ */
+void profile_apply ( struct proxy_t *proxy, int index, int sock )
+{
+    const struct profile_t *profile = proxy->profiles + index;
+
+    if ( profile->nodelay && setsockopt ( sock, IPPROTO_TCP, TCP_NODELAY,
+            &profile->nodelay, sizeof ( profile->nodelay ) ) < 0 )
+    {
+        verbose ( "cannot set socket:%i nodelay (%i)\n", sock, errno );
+    }
+
+    if ( profile->lowat && setsockopt ( sock, IPPROTO_TCP, TCP_NOTSENT_LOWAT,
+            &profile->lowat, sizeof ( profile->lowat ) ) < 0 )
+    {
+        verbose ( "cannot set socket:%i not sent low-water mark (%i)\n", sock, errno );
+    }
+
+    if ( profile->sndbuf && setsockopt ( sock, SOL_SOCKET, SO_SNDBUF,
+            &profile->sndbuf, sizeof ( profile->sndbuf ) ) < 0 )
+    {
+        verbose ( "cannot set socket:%i send buffer (%i)\n", sock, errno );
+    }
+
+    if ( profile->rcvbuf && setsockopt ( sock, SOL_SOCKET, SO_RCVBUF,
+            &profile->rcvbuf, sizeof ( profile->rcvbuf ) ) < 0 )
+    {
+        verbose ( "cannot set socket:%i receive buffer (%i)\n", sock, errno );
+    }
+
+    if ( profile->congestion[0] && setsockopt ( sock, IPPROTO_TCP, TCP_CONGESTION,
+            profile->congestion, strlen ( profile->congestion ) ) < 0 )
+    {
+        verbose ( "cannot set socket:%i congestion control (%i)\n", sock, errno );
+    }
+}
+
+/**
+ * Apply destination profile to the client side of new relation
+ */
+void profile_start ( struct proxy_t *proxy, struct stream_t *relation,
+    const struct sockaddr_storage *saddr )
+{
+    int index;
+
+    /* Endpoint side got the profile before connecting */
+    index = profile_match ( proxy, saddr );
+    proxy->stream_profiles[relation->index] = index + 1;
+
+    if ( index < 0 )
+    {
+        return;
+    }
+
+    profile_apply ( proxy, index, relation->neighbour->fd );
+    proxy->stat_profiled++;
+
+    verbose ( "relation with socket:%i uses profile #%i\n", relation->fd, index + 1 );
+}
+
+/**
+ * Check if profile of the relation asks for no delay
+ */
+int profile_nodelay ( struct proxy_t *proxy, const struct stream_t *relation )
+{
+    int index;
+
+    if ( !proxy->stream_profiles || !( index = proxy->stream_profiles[relation->index] ) )
+    {
+        return 0;
+    }
+
+    return proxy->profiles[index - 1].nodelay;
+}
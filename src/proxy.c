@@ -4,43 +4,230 @@
 
 #include "axproxy.h"
 
+/**
+ * Statistics report request flag
+ */
+static volatile sig_atomic_t stats_requested = 0;
+
+/**
+ * Handle statistics report signal
+ */
+static void stats_signal_handler ( int signo )
+{
+    UNUSED ( signo );
+    stats_requested = 1;
+}
+
+/**
+ * Report loop timing histogram
+ */
+static void report_histogram ( struct proxy_t *proxy, const char *name,
+    const unsigned long *hist )
+{
+    int i;
+    size_t len = 0;
+    char buffer[LOOP_HIST_BUCKETS * 24];
+
+    buffer[0] = '\0';
+
+    /* Bucket N holds durations below 2^N usec */
+    for ( i = 0; i < LOOP_HIST_BUCKETS; i++ )
+    {
+        if ( hist[i] && len < sizeof ( buffer ) )
+        {
+            len += snprintf ( buffer + len, sizeof ( buffer ) - len, " <%luus:%lu",
+                1UL << i, hist[i] );
+        }
+    }
+
+    info ( "worker #%i: %s%s\n", proxy->worker_id, name, buffer );
+}
+
+/**
+ * Report worker statistics
+ */
+static void report_stats ( struct proxy_t *proxy )
+{
+    info ( "worker #%i: streams:%lu/%lu slots:%lu accepted:%lu relations:%lu"
+        " forwarded:%llu byte(s) epoll_ctl:%lu io_uring_enter:%lu\n", proxy->worker_id,
+        ( unsigned long ) proxy->stream_count, ( unsigned long ) proxy->stream_limit,
+        ( unsigned long ) proxy->stream_total, proxy->stat_accepted,
+        proxy->stat_relations, proxy->stat_forwarded, proxy->stat_epoll_ctl,
+        proxy->stat_uring_enter );
+    if ( proxy->splice )
+    {
+        info ( "worker #%i: spliced:%llu byte(s) pipes-idle:%lu\n", proxy->worker_id,
+            proxy->stat_spliced, ( unsigned long ) proxy->pipe_idle );
+    }
+    if ( proxy->tune_limit )
+    {
+        info ( "worker #%i: tuned:%lu tune-memory:%lu/%lu byte(s)\n", proxy->worker_id,
+            proxy->stat_tuned, ( unsigned long ) proxy->tune_used,
+            ( unsigned long ) proxy->tune_limit );
+    }
+    if ( proxy->sockmap )
+    {
+        info ( "worker #%i: redirected:%llu byte(s) relations:%lu/%lu demoted:%lu\n",
+            proxy->worker_id, proxy->stat_redirected,
+            ( unsigned long ) sockmap_relations ( proxy ), proxy->stat_sockmap,
+            proxy->stat_demoted );
+    }
+    if ( proxy->flows )
+    {
+        info ( "worker #%i: interactive:%lu bulk:%lu reclassified:%lu\n", proxy->worker_id,
+            ( unsigned long ) proxy->flow_interactive, ( unsigned long ) proxy->flow_bulk,
+            proxy->stat_reclassified );
+    }
+    if ( proxy->profile_count )
+    {
+        info ( "worker #%i: profiled:%lu relation(s) with %lu profile(s)\n", proxy->worker_id,
+            proxy->stat_profiled, ( unsigned long ) proxy->profile_count );
+    }
+    if ( proxy->stat_associations )
+    {
+        info ( "worker #%i: udp associations:%lu datagrams:%llu dropped:%lu calls:%lu\n",
+            proxy->worker_id, proxy->stat_associations, proxy->stat_datagrams,
+            proxy->stat_udp_dropped, proxy->stat_udp_calls );
+    }
+    if ( proxy->fast_open )
+    {
+        info ( "worker #%i: fast-open connects:%lu early:%llu byte(s)\n", proxy->worker_id,
+            proxy->stat_fastopen, proxy->stat_early );
+    }
+    if ( proxy->busy_poll )
+    {
+        info ( "worker #%i: busy-poll spins:%lu hits:%lu spin-time:%llu us\n",
+            proxy->worker_id, proxy->stat_spins, proxy->stat_spin_hits,
+            proxy->stat_spin_usec );
+    }
+    if ( proxy->cpu_pinning )
+    {
+        info ( "worker #%i: cpu:%i accepted:%lu steered:%lu\n", proxy->worker_id,
+            proxy->worker_cpu, proxy->stat_accepted, proxy->stat_cpu_local );
+    }
+    info ( "worker #%i: stalls:%lu deferred:%lu shed-accept:%lu shed-connect:%lu"
+        " shed-source:%lu\n", proxy->worker_id, proxy->stat_stalls, proxy->stat_deferred,
+        proxy->stat_shed_accept, proxy->stat_shed_connect, proxy->stat_shed_source );
+    report_histogram ( proxy, "dispatch", proxy->hist_dispatch );
+    report_histogram ( proxy, "wakeup-gap", proxy->hist_gap );
+    fflush ( stdout );
+}
+
+/**
+ * Describe stream stage
+ */
+const char *stream_stage ( int role, int level )
+{
+    if ( role == L_ACCEPT )
+    {
+        return "accept";
+    }
+
+    switch ( level )
+    {
+    case LEVEL_SOCKS_VER:
+        return "socks-version";
+    case LEVEL_SOCKS_AUTH:
+        return "socks-auth";
+    case LEVEL_SOCKS_REQ:
+        return "socks-request";
+    case LEVEL_SOCKS_PASS:
+        return "socks-reply";
+    case LEVEL_SOCKS_FAIL:
+        return "socks-fail";
+    case LEVEL_CONNECTING:
+        return "connect";
+    case LEVEL_FORWARDING:
+        return "forward";
+    case LEVEL_ASSOCIATED:
+        return role == S_PORT_U ? "udp-relay" : "udp-control";
+    }
+
+    return "unknown";
+}
+
 /**
  * Handle new stream creation
  */
 static int handle_new_stream ( struct proxy_t *proxy, struct stream_t *stream )
 {
+    int i;
     struct stream_t *util;
+    struct sockaddr_storage saddr;
 
     if ( ~stream->revents & POLLIN )
     {
         return -1;
     }
 
-    /* Accept incoming connection */
-    if ( !( util = accept_new_stream ( proxy, stream->fd ) ) )
+    /* Drain pending connections in a bounded batch */
+    for ( i = 0; i < ACCEPT_BATCH; i++ )
     {
-        return -2;
+        /* Accept incoming connection */
+        if ( !( util = accept_new_stream ( proxy, stream->fd,
+                    proxy->sources ? &saddr : NULL ) ) )
+        {
+            if ( accept_would_block ( errno ) )
+            {
+                break;
+            }
+
+            /* Pool stays full after cleanup, socket is already closed */
+            if ( errno == ENOBUFS )
+            {
+                proxy->stat_shed_accept++;
+                break;
+            }
+            return -2;
+        }
+
+        /* Loop is too slow to serve one more client */
+        if ( admission_lagging ( proxy ) )
+        {
+            verbose ( "loop lags, closing new socket:%i\n", util->fd );
+            proxy->stat_shed_accept++;
+            remove_stream ( proxy, util );
+            continue;
+        }
+
+        /* Client source holds too many connections or reconnects too fast */
+        if ( source_admit ( proxy, util, &saddr ) < 0 )
+        {
+            proxy->stat_shed_source++;
+            remove_stream ( proxy, util );
+            continue;
+        }
+
+        /* Setup new stream */
+        util->role = S_PORT_A;
+        util->level = LEVEL_SOCKS_VER;
+        stream_set_list ( proxy, util, LIST_HANDSHAKE );
+        stream_set_events ( proxy, util, POLLIN );
+        stream_set_timer ( proxy, util, HANDSHAKE_TIMEOUT_MSEC );
     }
 
-    /* Setup new stream */
-    util->role = S_PORT_A;
-    util->level = LEVEL_SOCKS_VER;
-    util->events = POLLIN;
+    if ( i )
+    {
+        verbose ( "accepted %i connection%s on socket:%i\n", i, i == 1 ? "" : "s",
+            stream->fd );
+    }
 
     return 0;
 }
 
 /**
- * Estabilish connection with endpoint
+ * Estabilish connection with endpoint, client data following the request goes first
  */
 static int setup_endpoint_stream ( struct proxy_t *proxy, struct stream_t *stream,
-    const struct sockaddr_storage *saddr )
+    const struct sockaddr_storage *saddr, const uint8_t * early, size_t len )
 {
     int sock;
+    size_t sent = len;
     struct stream_t *neighbour;
+    struct queue_t *queue;
 
     /* Connect remote endpoint asynchronously */
-    if ( ( sock = connect_async ( proxy, saddr ) ) < 0 )
+    if ( ( sock = connect_async ( proxy, saddr, early, &sent ) ) < 0 )
     {
         return sock;
     }
@@ -59,20 +246,131 @@ static int setup_endpoint_stream ( struct proxy_t *proxy, struct stream_t *strea
         return -2;
     }
 
+    /* Early data not taken by the SYN waits for the connect */
+    if ( sent < len && ( !( queue = queue_acquire ( proxy, neighbour ) )
+            || queue_set ( queue, early + sent, len - sent ) < 0 ) )
+    {
+        remove_stream ( proxy, neighbour );
+        return -1;
+    }
+
     /* Set neighbour role */
     neighbour->role = S_PORT_B;
     neighbour->level = LEVEL_CONNECTING;
-    neighbour->events = POLLIN | POLLOUT;
+    stream_set_events ( proxy, neighbour, POLLIN | POLLOUT );
+
+    /* Relation deadline and eviction order are now kept by the endpoint side */
+    stream_set_list ( proxy, stream, LIST_OTHER );
+    stream_set_list ( proxy, neighbour, LIST_CONNECTING );
+    stream_clear_timer ( proxy, stream );
+    stream_set_timer ( proxy, neighbour, CONNECT_TIMEOUT_MSEC );
 
     /* Build up a new relation */
     neighbour->neighbour = stream;
     stream->neighbour = neighbour;
 
+    if ( proxy->profile_count )
+    {
+        profile_start ( proxy, neighbour, saddr );
+    }
+
     verbose ( "new relation between socket:%i and socket:%i\n", stream->fd, sock );
 
     return 0;
 }
 
+/**
+ * Handle socks udp associate request
+ */
+static int handle_stream_associate ( struct proxy_t *proxy, struct stream_t *stream,
+    struct queue_t *queue )
+{
+    size_t len;
+    size_t reqlen;
+    uint16_t port;
+    uint8_t arr[22];
+    struct sockaddr_storage saddr;
+
+    verbose ( "got udp associate request from socket:%i\n", stream->fd );
+
+    /* Client address is taken from the control connection, only port is used */
+    if ( queue->arr[3] == 1 )
+    {
+        reqlen = 10;
+
+    } else if ( queue->arr[3] == 4 )
+    {
+        reqlen = 22;
+
+    } else if ( queue->arr[3] == 3 )
+    {
+        /* Assert hostname length is present */
+        if ( check_enough_data ( proxy, stream, 5 ) < 0 )
+        {
+            return 0;
+        }
+
+        reqlen = queue->arr[4] + 7;
+
+    } else
+    {
+        verbose ( "unknown associate mode (0x%.2x) requested from socket:%i...\n",
+            queue->arr[3], stream->fd );
+        return -1;
+    }
+
+    /* Assert minimum data length */
+    if ( check_enough_data ( proxy, stream, reqlen ) < 0 )
+    {
+        return 0;
+    }
+
+    memcpy ( &port, queue->arr + reqlen - 2, 2 );
+
+    if ( udp_associate ( proxy, stream, port, &saddr ) < 0 )
+    {
+        failure ( "cannot setup udp association for socket:%i\n", stream->fd );
+        return -1;
+    }
+
+    /* Prepare response with relay address */
+    arr[0] = 5; /* SOCKS5 version */
+    arr[1] = 0; /* Request granted */
+    arr[2] = 0; /* Reserved */
+
+    if ( saddr.ss_family == AF_INET )
+    {
+        arr[3] = 1;     /* Address type: IPv4 */
+        memcpy ( arr + 4, &( ( struct sockaddr_in * ) &saddr )->sin_addr, 4 );
+        memcpy ( arr + 8, &( ( struct sockaddr_in * ) &saddr )->sin_port, 2 );
+        len = 10;
+
+    } else if ( IN6_IS_ADDR_V4MAPPED ( &( ( struct sockaddr_in6 * ) &saddr )->sin6_addr ) )
+    {
+        arr[3] = 1;     /* Address type: IPv4 */
+        memcpy ( arr + 4, ( ( struct sockaddr_in6 * ) &saddr )->sin6_addr.s6_addr + 12, 4 );
+        memcpy ( arr + 8, &( ( struct sockaddr_in6 * ) &saddr )->sin6_port, 2 );
+        len = 10;
+
+    } else
+    {
+        arr[3] = 4;     /* Address type: IPv6 */
+        memcpy ( arr + 4, &( ( struct sockaddr_in6 * ) &saddr )->sin6_addr, 16 );
+        memcpy ( arr + 20, &( ( struct sockaddr_in6 * ) &saddr )->sin6_port, 2 );
+        len = 22;
+    }
+
+    /* Enqueue response */
+    if ( queue_set ( queue, arr, len ) < 0 )
+    {
+        return -1;
+    }
+
+    stream_set_events ( proxy, stream, POLLOUT );
+
+    return 0;
+}
+
 /**
  * Handle stream socks handshake and request
  */
@@ -81,12 +379,14 @@ static int handle_stream_socks ( struct proxy_t *proxy, struct stream_t *stream
     int status;
     size_t len;
     size_t hostlen;
+    size_t reqlen;
     struct sockaddr_storage saddr;
     struct sockaddr_in *saddr_in;
     struct sockaddr_in6 *saddr_in6;
     char straddr[STRADDR_SIZE];
     char hostname[256];
     uint8_t arr[DATA_QUEUE_CAPACITY];
+    struct queue_t *queue;
 
     /* Expect socket ready to be read */
     if ( ~stream->revents & POLLIN )
@@ -95,17 +395,36 @@ static int handle_stream_socks ( struct proxy_t *proxy, struct stream_t *stream
     }
 
     /* Receive data chunk */
-    if ( ( ssize_t ) ( len = recv ( stream->fd, arr, sizeof ( arr ), 0 ) ) < 2 )
+    if ( ( ssize_t ) ( len = recv ( stream->fd, arr, sizeof ( arr ), 0 ) ) < 0
+        && ( errno == EAGAIN || errno == EWOULDBLOCK ) )
+    {
+        stream_clear_ready ( stream, POLLIN );
+        return 0;
+    }
+
+    if ( ( ssize_t ) len < 2 )
     {
         failure ( "cannot receive data (%i) from socket:%i\n", errno, stream->fd );
         return -1;
     }
 
+    /* Input was drained if buffer was not filled */
+    if ( len < sizeof ( arr ) )
+    {
+        stream_clear_ready ( stream, POLLIN );
+    }
+
     /* Print progress */
     verbose ( "received %i byte(s) in handshake from socket:%i\n", ( int ) len, stream->fd );
 
+    /* Handshake queue is taken on demand */
+    if ( !( queue = queue_acquire ( proxy, stream ) ) )
+    {
+        return -1;
+    }
+
     /* Enqueue input data */
-    if ( queue_push ( &stream->queue, arr, len ) < 0 )
+    if ( queue_push ( queue, arr, len ) < 0 )
     {
         return -1;
     }
@@ -124,15 +443,15 @@ static int handle_stream_socks ( struct proxy_t *proxy, struct stream_t *stream
         }
 
         /* Check for SOCKS5 version */
-        if ( stream->queue.arr[0] != 5 )
+        if ( queue->arr[0] != 5 )
         {
-            failure ( "invalid socks version (0x%.2x) from socket:%i\n", stream->queue.arr[0],
+            failure ( "invalid socks version (0x%.2x) from socket:%i\n", queue->arr[0],
                 stream->fd );
             return -1;
         }
 
         /* User - pass auth or no auth */
-        if ( len > 2 && stream->queue.arr[1] == 1 && stream->queue.arr[2] == 2 )
+        if ( len > 2 && queue->arr[1] == 1 && queue->arr[2] == 2 )
         {
             arr[0] = 5; /* SOCKS5 version */
             arr[1] = 2; /* User - pass auth */
@@ -146,13 +465,13 @@ static int handle_stream_socks ( struct proxy_t *proxy, struct stream_t *stream
         }
 
         /* Enqueue response */
-        if ( queue_set ( &stream->queue, arr, 2 ) < 0 )
+        if ( queue_set ( queue, arr, 2 ) < 0 )
         {
             return -1;
         }
 
         /* Update levels and events flags */
-        stream->events = POLLOUT;
+        stream_set_events ( proxy, stream, POLLOUT );
         break;
     case LEVEL_SOCKS_AUTH:
         /* Print current stage */
@@ -163,14 +482,14 @@ static int handle_stream_socks ( struct proxy_t *proxy, struct stream_t *stream
         arr[1] = 0;     /* Auth success */
 
         /* Enqueue response */
-        if ( queue_set ( &stream->queue, arr, 2 ) < 0 )
+        if ( queue_set ( queue, arr, 2 ) < 0 )
         {
             return -1;
         }
 
         /* Update levels and events flags */
         stream->level = LEVEL_SOCKS_REQ;
-        stream->events = POLLOUT;
+        stream_set_events ( proxy, stream, POLLOUT );
         break;
     case LEVEL_SOCKS_REQ:
         /* Print current stage */
@@ -182,24 +501,53 @@ static int handle_stream_socks ( struct proxy_t *proxy, struct stream_t *stream
             return 0;
         }
 
-        /* Expect SOCKS5 version + request opcode */
-        if ( stream->queue.arr[0] != 5 || stream->queue.arr[1] != 1 || stream->queue.arr[2] != 0 )
+        /* Expect SOCKS5 version + connect or udp associate opcode */
+        if ( queue->arr[0] != 5 || ( queue->arr[1] != 1 && queue->arr[1] != 3 )
+            || queue->arr[2] != 0 )
         {
             failure ( "invalid socks request from socket:%i\n", stream->fd );
             return -1;
         }
 
+        /* Refuse at once so the client can fail over */
+        if ( admission_crowded ( proxy ) || admission_lagging ( proxy ) )
+        {
+            verbose ( "overloaded, refusing request from socket:%i\n", stream->fd );
+            proxy->stat_shed_connect++;
+
+            arr[0] = 5; /* SOCKS5 version */
+            arr[1] = 1; /* General failure */
+            memset ( arr + 2, '\0', 8 );
+            arr[3] = 1; /* Address type: IPv4 */
+
+            if ( queue_set ( queue, arr, 10 ) < 0 )
+            {
+                return -1;
+            }
+
+            stream->level = LEVEL_SOCKS_FAIL;
+            stream_set_events ( proxy, stream, POLLOUT );
+            break;
+        }
+
+        /* Datagrams are relayed next to the control connection */
+        if ( queue->arr[1] == 3 )
+        {
+            return handle_stream_associate ( proxy, stream, queue );
+        }
+
         /* Clear socket address */
         memset ( &saddr, '\0', sizeof ( saddr ) );
 
         /* Direct connect or by hostname */
-        if ( stream->queue.arr[3] == 1 )
+        if ( queue->arr[3] == 1 )
         {
             /* Print progress */
             verbose ( "got connect by ipv4 address request from socket:%i\n", stream->fd );
 
             /* Assert minimum data length */
-            if ( check_enough_data ( proxy, stream, 10 ) < 0 )
+            reqlen = 10;
+            if ( check_enough_data ( proxy, stream, reqlen ) < 0 )
             {
                 return 0;
             }
@@ -209,8 +557,8 @@ static int handle_stream_socks ( struct proxy_t *proxy, struct stream_t *stream
             saddr_in->sin_family = AF_INET;
 
             /* Parse network address then port number */
-            memcpy ( &saddr_in->sin_addr, stream->queue.arr + 4, 4 );
-            saddr_in->sin_port = htons ( ( ( stream->queue.arr[8] ) << 8 ) | stream->queue.arr[9] );
+            memcpy ( &saddr_in->sin_addr, queue->arr + 4, 4 );
+            saddr_in->sin_port = htons ( ( ( queue->arr[8] ) << 8 ) | queue->arr[9] );
             if ( proxy->verbose )
             {
                 format_ip_port ( &saddr, straddr, sizeof ( straddr ) );
@@ -218,7 +566,7 @@ static int handle_stream_socks ( struct proxy_t *proxy, struct stream_t *stream
             verbose ( "connect by ipv4 address to (%s) requested from socket:%i...\n", straddr,
                 stream->fd );
 
-        } else if ( stream->queue.arr[3] == 3 )
+        } else if ( queue->arr[3] == 3 )
         {
             /* Print progress */
             verbose ( "got connect by hostname request from socket:%i\n", stream->fd );
@@ -230,7 +578,7 @@ static int handle_stream_socks ( struct proxy_t *proxy, struct stream_t *stream
             }
 
             /* Parse hostname length */
-            hostlen = stream->queue.arr[4];
+            hostlen = queue->arr[4];
 
             /* Assert maximum data length */
             if ( hostlen >= sizeof ( hostname ) )
@@ -240,7 +588,8 @@ static int handle_stream_socks ( struct proxy_t *proxy, struct stream_t *stream
             }
 
             /* Assert minimum data length */
-            if ( check_enough_data ( proxy, stream, hostlen + 7 ) < 0 )
+            reqlen = hostlen + 7;
+            if ( check_enough_data ( proxy, stream, reqlen ) < 0 )
             {
                 return 0;
             }
@@ -251,15 +600,21 @@ static int handle_stream_socks ( struct proxy_t *proxy, struct stream_t *stream
 
             /* Parse hostname then port number */
             saddr_in->sin_port =
-                htons ( ( ( stream->queue.arr[5 + hostlen] ) << 8 ) | stream->queue.arr[6 +
+                htons ( ( ( queue->arr[5 + hostlen] ) << 8 ) | queue->arr[6 +
                     hostlen] );
-            memcpy ( hostname, stream->queue.arr + 5, hostlen );
+            memcpy ( hostname, queue->arr + 5, hostlen );
             hostname[hostlen] = '\0';
 
             /* Print progress */
             verbose ( "connect by hostname to (%s) requested from socket:%i...\n", hostname,
                 stream->fd );
 
+            /* Name the hostname if resolving stalls the loop */
+            if ( proxy->stall_threshold )
+            {
+                memcpy ( proxy->dispatch_host, hostname, hostlen + 1 );
+            }
+
             /* Resolve hostname */
             if ( nsaddr_cached ( hostname, &saddr_in->sin_addr.s_addr ) < 0 )
             {
@@ -274,13 +629,14 @@ static int handle_stream_socks ( struct proxy_t *proxy, struct stream_t *stream
 
             verbose ( "resolved address by hostname for socket:%i to %s\n", stream->fd, straddr );
 
-        } else if ( stream->queue.arr[3] == 4 )
+        } else if ( queue->arr[3] == 4 )
         {
             /* Print progress */
             verbose ( "got connect by ipv6 address request from socket:%i\n", stream->fd );
 
             /* Assert minimum data length */
-            if ( check_enough_data ( proxy, stream, 22 ) < 0 )
+            reqlen = 22;
+            if ( check_enough_data ( proxy, stream, reqlen ) < 0 )
             {
                 return 0;
             }
@@ -290,9 +646,9 @@ static int handle_stream_socks ( struct proxy_t *proxy, struct stream_t *stream
             saddr_in6->sin6_family = AF_INET6;
 
             /* Parse network address then port number */
-            memcpy ( &saddr_in6->sin6_addr, stream->queue.arr + 4, 16 );
+            memcpy ( &saddr_in6->sin6_addr, queue->arr + 4, 16 );
             saddr_in6->sin6_port =
-                htons ( ( ( stream->queue.arr[20] ) << 8 ) | stream->queue.arr[21] );
+                htons ( ( ( queue->arr[20] ) << 8 ) | queue->arr[21] );
             if ( proxy->verbose )
             {
                 format_ip_port ( &saddr, straddr, sizeof ( straddr ) );
@@ -304,12 +660,13 @@ static int handle_stream_socks ( struct proxy_t *proxy, struct stream_t *stream
         } else
         {
             verbose ( "unknown connect mode (0x%.2x) requested from socket:%i...\n",
-                stream->queue.arr[3], stream->fd );
+                queue->arr[3], stream->fd );
             return -1;
         }
 
-        /* Connect endpoint */
-        if ( ( status = setup_endpoint_stream ( proxy, stream, &saddr ) ) < 0 )
+        /* Connect endpoint, passing client data sent along with the request */
+        if ( ( status = setup_endpoint_stream ( proxy, stream, &saddr, queue->arr + reqlen,
+                    queue->len - reqlen ) ) < 0 )
         {
             return status;
         }
@@ -329,14 +686,14 @@ static int handle_stream_socks ( struct proxy_t *proxy, struct stream_t *stream
         arr[9] = 0;     /* Port 2nd byte */
 
         /* Enqueue response */
-        if ( queue_set ( &stream->queue, arr, 10 ) < 0 )
+        if ( queue_set ( queue, arr, 10 ) < 0 )
         {
             return -1;
         }
 
         /* Update levels and events flags */
         stream->level = LEVEL_SOCKS_PASS;
-        stream->events = POLLOUT;
+        stream_set_events ( proxy, stream, POLLOUT );
         break;
     default:
         return -1;
@@ -351,26 +708,69 @@ static int handle_stream_socks ( struct proxy_t *proxy, struct stream_t *stream
 int handle_stream_events ( struct proxy_t *proxy, struct stream_t *stream )
 {
     int status;
+    short events;
 
-    if ( handle_forward_data ( proxy, stream ) >= 0 )
+    /* Pending handshake reply goes out before any forwarding */
+    if ( stream->queue && stream->queue->len && ( stream->revents & POLLOUT )
+        && stream->level != LEVEL_CONNECTING )
     {
+        if ( queue_shift ( stream->queue, stream->fd ) < 0 )
+        {
+            remove_relation ( proxy, stream );
+            return 0;
+        }
+        if ( stream->queue->len )
+        {
+            stream_clear_ready ( stream, POLLOUT );
+            return 0;
+        }
+        if ( stream->level == LEVEL_SOCKS_PASS )
+        {
+            queue_release ( proxy, stream );
+            stream_set_events ( proxy, stream, 0 );
+
+        } else if ( stream->level == LEVEL_SOCKS_FAIL )
+        {
+            remove_relation ( proxy, stream );
+
+        } else if ( stream->level == LEVEL_ASSOCIATED )
+        {
+            /* Control connection is only watched for its end */
+            queue_release ( proxy, stream );
+            stream_set_events ( proxy, stream, POLLIN );
+
+        } else if ( stream->level == LEVEL_FORWARDING )
+        {
+            queue_release ( proxy, stream );
+            stream_set_events ( proxy, stream, stream_edge_triggered ( proxy, stream )
+                ? POLLIN | POLLOUT : POLLIN );
+            /* Endpoint data held back by the reply follows right away */
+            if ( handle_forward_data ( proxy, stream ) < 0 )
+            {
+                remove_relation ( proxy, stream );
+            }
+
+        } else
+        {
+            stream_set_events ( proxy, stream, POLLIN );
+        }
         return 0;
     }
 
-    if ( stream->role == S_PORT_A && stream->queue.len && ( stream->revents & POLLOUT ) )
+    if ( stream->level == LEVEL_ASSOCIATED )
     {
-        if ( queue_shift ( &stream->queue, stream->fd ) < 0 )
+        if ( udp_handle_events ( proxy, stream ) < 0 )
         {
-            remove_relation ( stream );
-            return 0;
-        }
-        if ( stream->queue.len == 0 )
-        {
-            stream->events = stream->level == LEVEL_SOCKS_PASS ? 0 : POLLIN;
+            remove_relation ( proxy, stream );
         }
         return 0;
     }
 
+    if ( handle_forward_data ( proxy, stream ) >= 0 )
+    {
+        return 0;
+    }
+
     switch ( stream->role )
     {
     case L_ACCEPT:
@@ -396,16 +796,54 @@ int handle_stream_events ( struct proxy_t *proxy, struct stream_t *stream )
             && ( stream->revents & ( POLLIN | POLLOUT ) ) )
         {
             verbose ( "async connect completed for socket:%i\n", stream->fd );
+            /* Early client data goes ahead of anything relayed, fits empty send buffer */
+            if ( stream->queue )
+            {
+                if ( queue_shift ( stream->queue, stream->fd ) < 0 || stream->queue->len )
+                {
+                    break;
+                }
+                queue_release ( proxy, stream );
+            }
+            /* Edge-triggered streams watch both directions all the time */
+            events = stream_edge_triggered ( proxy, stream ) ? POLLIN | POLLOUT : POLLIN;
             stream->level = LEVEL_FORWARDING;
-            stream->events = POLLIN;
+            stream_set_events ( proxy, stream, events );
             stream->neighbour->level = LEVEL_FORWARDING;
-            stream->neighbour->events = POLLIN;
+            /* Reply still queued on the client side keeps the handshake open */
+            if ( stream->neighbour->queue && stream->neighbour->queue->len )
+            {
+                stream_set_events ( proxy, stream->neighbour, POLLOUT );
+
+            } else
+            {
+                queue_release ( proxy, stream->neighbour );
+                stream_set_events ( proxy, stream->neighbour, events );
+            }
+            proxy->stat_relations++;
+
+            if ( proxy->flows )
+            {
+                flow_start ( proxy, stream );
+            }
+
+            /* Connect deadline turns into idle deadline */
+            stream_set_list ( proxy, stream, LIST_ESTABLISHED );
+            if ( proxy->idle_timeout )
+            {
+                stream->active = proxy->now / TIMER_TICK_MSEC;
+                stream_set_timer ( proxy, stream, proxy->idle_timeout * 1000 );
+
+            } else
+            {
+                stream_clear_timer ( proxy, stream );
+            }
             return 0;
         }
         break;
     }
 
-    remove_relation ( stream );
+    remove_relation ( proxy, stream );
 
     return 0;
 }
@@ -418,14 +856,11 @@ int proxy_task ( struct proxy_t *proxy )
     int status = 0;
     int sock;
     struct stream_t *stream;
+    struct sigaction action;
 
-    /* Set stream size */
-    proxy->stream_size = sizeof ( struct stream_t );
-
-    /* Reset current state */
-    proxy->stream_head = NULL;
-    proxy->stream_tail = NULL;
-    memset ( proxy->stream_pool, '\0', sizeof ( proxy->stream_pool ) );
+    /* Set stream size, whole cache lines */
+    proxy->stream_size = ( sizeof ( struct stream_t ) + CACHE_LINE_SIZE - 1 )
+        & ~( ( size_t ) CACHE_LINE_SIZE - 1 );
 
     /* Proxy events setup */
     if ( proxy_events_setup ( proxy ) < 0 )
@@ -433,13 +868,20 @@ int proxy_task ( struct proxy_t *proxy )
         return -1;
     }
 
-    /* Setup listen socket */
-    if ( ( sock = listen_socket ( proxy, &proxy->entrance ) ) < 0 )
+    /* Allocate stream pool, resets current state */
+    if ( stream_pool_setup ( proxy ) < 0 )
     {
-        if ( proxy->epoll_fd >= 0 )
-        {
-            close ( proxy->epoll_fd );
-        }
+        failure ( "cannot allocate stream pool (%i)\n", errno );
+        proxy_events_cleanup ( proxy );
+        return -1;
+    }
+
+    /* Setup listen socket unless provided by the worker pool */
+    if ( ( sock = proxy->listen_fd ) < 0
+        && ( sock = listen_socket ( proxy, &proxy->entrance ) ) < 0 )
+    {
+        stream_pool_free ( proxy );
+        proxy_events_cleanup ( proxy );
         return -1;
     }
 
@@ -447,30 +889,38 @@ int proxy_task ( struct proxy_t *proxy )
     if ( !( stream = insert_stream ( proxy, sock ) ) )
     {
         shutdown_then_close ( proxy, sock );
-        if ( proxy->epoll_fd >= 0 )
-        {
-            close ( proxy->epoll_fd );
-        }
+        stream_pool_free ( proxy );
+        proxy_events_cleanup ( proxy );
         return -1;
     }
 
     /* Update listen stream */
     stream->role = L_ACCEPT;
-    stream->events = POLLIN;
+    stream_set_events ( proxy, stream, POLLIN );
+
+    /* Report statistics on demand */
+    memset ( &action, '\0', sizeof ( action ) );
+    action.sa_handler = stats_signal_handler;
+    sigaction ( SIGUSR1, &action, NULL );
 
     verbose ( "proxy setup was successful\n" );
 
     /* Run forward loop */
-    while ( ( status = handle_streams_cycle ( proxy ) ) >= 0 );
+    while ( ( status = handle_streams_cycle ( proxy ) ) >= 0 )
+    {
+        if ( stats_requested )
+        {
+            stats_requested = 0;
+            report_stats ( proxy );
+        }
+    }
 
     /* Remove all streams */
     remove_all_streams ( proxy );
+    stream_pool_free ( proxy );
 
-    /* Close epoll fd if created */
-    if ( proxy->epoll_fd >= 0 )
-    {
-        close ( proxy->epoll_fd );
-    }
+    /* Release epoll fd or io_uring */
+    proxy_events_cleanup ( proxy );
 
     verbose ( "done proxy uninitializing\n" );
 
@@ -0,0 +1,789 @@
+/* ------------------------------------------------------------------
+ * Proxy Util - Kernel Relay with BPF Sockmap
+ * ------------------------------------------------------------------ */
+
+#define PROXY_UTIL_BASE_STRUCTS
+#include "util.h"
+
+#if defined(__has_include)
+#if __has_include(<linux/bpf.h>)
+#include <linux/bpf.h>
+#include <stddef.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#endif
+#endif
+
+#if defined(__NR_bpf) && defined(BPF_ATOMIC)
+
+/**
+ * Stream state in kernel relay
+ */
+struct redirect_t
+{
+    struct redirect_t *prev;
+    struct redirect_t *next;
+    struct stream_t *stream;
+    uint64_t cookie;
+    unsigned long long sent;
+    unsigned long long seen;
+    unsigned long long checked;
+    unsigned char armed;
+    unsigned char mapped;
+    unsigned char drained;
+    unsigned char congested;
+};
+
+/**
+ * Peer entry found by socket cookie
+ */
+struct redirect_peer_t
+{
+    uint32_t peer;
+    uint32_t self;
+};
+
+/**
+ * Kernel relay state
+ */
+struct proxy_sockmap_t
+{
+    int sockmap_fd;
+    int peers_fd;
+    int moved_fd;
+    int verdict_fd;
+    size_t len;
+    size_t moved_size;
+    volatile uint64_t *moved;
+    struct redirect_t **redirects;
+    struct redirect_t *head;
+    size_t relations;
+    unsigned long tick;
+};
+
+/**
+ * Call bpf system call
+ */
+static long sockmap_bpf ( int cmd, union bpf_attr *attr )
+{
+    return syscall ( __NR_bpf, cmd, attr, sizeof ( *attr ) );
+}
+
+/**
+ * Create BPF map
+ */
+static int sockmap_map_create ( unsigned int type, unsigned int key_size,
+    unsigned int value_size, size_t entries, unsigned int flags )
+{
+    union bpf_attr attr;
+
+    memset ( &attr, '\0', sizeof ( attr ) );
+    attr.map_type = type;
+    attr.key_size = key_size;
+    attr.value_size = value_size;
+    attr.max_entries = entries;
+    attr.map_flags = flags;
+
+    return sockmap_bpf ( BPF_MAP_CREATE, &attr );
+}
+
+/**
+ * Insert or replace BPF map element
+ */
+static int sockmap_map_update ( int fd, const void *key, const void *value )
+{
+    union bpf_attr attr;
+
+    memset ( &attr, '\0', sizeof ( attr ) );
+    attr.map_fd = fd;
+    attr.key = ( uintptr_t ) key;
+    attr.value = ( uintptr_t ) value;
+    attr.flags = BPF_ANY;
+
+    return sockmap_bpf ( BPF_MAP_UPDATE_ELEM, &attr );
+}
+
+/**
+ * Delete BPF map element
+ */
+static int sockmap_map_delete ( int fd, const void *key )
+{
+    union bpf_attr attr;
+
+    memset ( &attr, '\0', sizeof ( attr ) );
+    attr.map_fd = fd;
+    attr.key = ( uintptr_t ) key;
+
+    return sockmap_bpf ( BPF_MAP_DELETE_ELEM, &attr );
+}
+
+/**
+ * Load verdict program and attach it to the sockmap
+ */
+static int sockmap_load_verdict ( struct proxy_sockmap_t *sockmap )
+{
+    union bpf_attr attr;
+    struct bpf_insn code[] = {
+        /* r6 = skb, r8 = skb->len */
+        {BPF_ALU64 | BPF_MOV | BPF_X, 6, 1, 0, 0},
+        {BPF_LDX | BPF_MEM | BPF_W, 8, 6, offsetof ( struct __sk_buff, len ), 0},
+        /* r0 = peers[socket cookie] */
+        {BPF_JMP | BPF_CALL, 0, 0, 0, BPF_FUNC_get_socket_cookie},
+        {BPF_STX | BPF_MEM | BPF_DW, 10, 0, -8, 0},
+        {BPF_LD | BPF_DW | BPF_IMM, 1, BPF_PSEUDO_MAP_FD, 0, sockmap->peers_fd},
+        {0, 0, 0, 0, 0},
+        {BPF_ALU64 | BPF_MOV | BPF_X, 2, 10, 0, 0},
+        {BPF_ALU64 | BPF_ADD | BPF_K, 2, 0, 0, -8},
+        {BPF_JMP | BPF_CALL, 0, 0, 0, BPF_FUNC_map_lookup_elem},
+        /* Socket without peer keeps its data */
+        {BPF_JMP | BPF_JEQ | BPF_K, 0, 0, 16, 0},
+        /* r7 = own index, r3 = peer index */
+        {BPF_LDX | BPF_MEM | BPF_W, 7, 0, 4, 0},
+        {BPF_LDX | BPF_MEM | BPF_W, 3, 0, 0, 0},
+        /* Send data out of the peer socket, unless it is not mapped */
+        {BPF_ALU64 | BPF_MOV | BPF_X, 1, 6, 0, 0},
+        {BPF_LD | BPF_DW | BPF_IMM, 2, BPF_PSEUDO_MAP_FD, 0, sockmap->sockmap_fd},
+        {0, 0, 0, 0, 0},
+        {BPF_ALU64 | BPF_MOV | BPF_K, 4, 0, 0, 0},
+        {BPF_JMP | BPF_CALL, 0, 0, 0, BPF_FUNC_sk_redirect_map},
+        {BPF_JMP | BPF_JEQ | BPF_K, 0, 0, 8, SK_DROP},
+        /* moved[own index] += skb->len */
+        {BPF_STX | BPF_MEM | BPF_W, 10, 7, -12, 0},
+        {BPF_LD | BPF_DW | BPF_IMM, 1, BPF_PSEUDO_MAP_FD, 0, sockmap->moved_fd},
+        {0, 0, 0, 0, 0},
+        {BPF_ALU64 | BPF_MOV | BPF_X, 2, 10, 0, 0},
+        {BPF_ALU64 | BPF_ADD | BPF_K, 2, 0, 0, -12},
+        {BPF_JMP | BPF_CALL, 0, 0, 0, BPF_FUNC_map_lookup_elem},
+        {BPF_JMP | BPF_JEQ | BPF_K, 0, 0, 1, 0},
+        {BPF_STX | BPF_ATOMIC | BPF_DW, 0, 8, 0, BPF_ADD},
+        /* Redirected or kept, data is never dropped */
+        {BPF_ALU64 | BPF_MOV | BPF_K, 0, 0, 0, SK_PASS},
+        {BPF_JMP | BPF_EXIT, 0, 0, 0, 0}
+    };
+
+    memset ( &attr, '\0', sizeof ( attr ) );
+    attr.prog_type = BPF_PROG_TYPE_SK_SKB;
+    attr.insns = ( uintptr_t ) code;
+    attr.insn_cnt = sizeof ( code ) / sizeof ( struct bpf_insn );
+    attr.license = ( uintptr_t ) "GPL";
+
+    if ( ( sockmap->verdict_fd = sockmap_bpf ( BPF_PROG_LOAD, &attr ) ) < 0 )
+    {
+        return -1;
+    }
+
+    memset ( &attr, '\0', sizeof ( attr ) );
+    attr.target_fd = sockmap->sockmap_fd;
+    attr.attach_bpf_fd = sockmap->verdict_fd;
+    attr.attach_type = BPF_SK_SKB_VERDICT;
+
+    return sockmap_bpf ( BPF_PROG_ATTACH, &attr );
+}
+
+/**
+ * Setup kernel relay maps and verdict program
+ */
+int sockmap_setup ( struct proxy_t *proxy )
+{
+    long page;
+    struct proxy_sockmap_t *sockmap;
+
+    proxy->sockmap = NULL;
+
+    if ( !proxy->kernel_relay )
+    {
+        return 0;
+    }
+
+    if ( !( sockmap = ( struct proxy_sockmap_t * ) calloc ( 1,
+                sizeof ( struct proxy_sockmap_t ) ) ) )
+    {
+        return -1;
+    }
+
+    sockmap->sockmap_fd = -1;
+    sockmap->peers_fd = -1;
+    sockmap->moved_fd = -1;
+    sockmap->verdict_fd = -1;
+    sockmap->moved = MAP_FAILED;
+    sockmap->tick = proxy->now / TIMER_TICK_MSEC;
+
+    /* Streams past the map size are relayed in user space */
+    sockmap->len = proxy->stream_limit < SOCKMAP_STREAMS_LIMIT
+        ? proxy->stream_limit : SOCKMAP_STREAMS_LIMIT;
+    page = sysconf ( _SC_PAGESIZE );
+    sockmap->moved_size = ( sockmap->len * sizeof ( uint64_t ) + page - 1 ) & ~( page - 1 );
+
+    if ( !( sockmap->redirects = ( struct redirect_t ** ) calloc ( sockmap->len,
+                sizeof ( struct redirect_t * ) ) ) )
+    {
+        free ( sockmap );
+        return -1;
+    }
+
+    proxy->sockmap = sockmap;
+
+    /* Bytes moved by the verdict program are read straight from memory */
+    if ( ( sockmap->sockmap_fd = sockmap_map_create ( BPF_MAP_TYPE_SOCKMAP, sizeof ( uint32_t ),
+                sizeof ( uint32_t ), sockmap->len, 0 ) ) < 0
+        || ( sockmap->peers_fd = sockmap_map_create ( BPF_MAP_TYPE_HASH, sizeof ( uint64_t ),
+                sizeof ( struct redirect_peer_t ), sockmap->len, BPF_F_NO_PREALLOC ) ) < 0
+        || ( sockmap->moved_fd = sockmap_map_create ( BPF_MAP_TYPE_ARRAY, sizeof ( uint32_t ),
+                sizeof ( uint64_t ), sockmap->len, BPF_F_MMAPABLE ) ) < 0
+        || ( sockmap->moved = ( volatile uint64_t * ) mmap ( NULL, sockmap->moved_size,
+                PROT_READ | PROT_WRITE, MAP_SHARED, sockmap->moved_fd, 0 ) ) == MAP_FAILED
+        || sockmap_load_verdict ( sockmap ) < 0 )
+    {
+        failure ( "kernel relay is not available (%i), forwarding in user space\n", errno );
+        sockmap_free ( proxy );
+        return 0;
+    }
+
+    verbose ( "kernel relay setup for %lu stream(s)\n", ( unsigned long ) sockmap->len );
+
+    return 0;
+}
+
+/**
+ * Release kernel relay maps and verdict program
+ */
+void sockmap_free ( struct proxy_t *proxy )
+{
+    size_t i;
+    struct proxy_sockmap_t *sockmap;
+
+    if ( !( sockmap = proxy->sockmap ) )
+    {
+        return;
+    }
+
+    for ( i = 0; i < sockmap->len; i++ )
+    {
+        free ( sockmap->redirects[i] );
+    }
+
+    if ( sockmap->moved != MAP_FAILED )
+    {
+        munmap ( ( void * ) sockmap->moved, sockmap->moved_size );
+    }
+
+    if ( sockmap->verdict_fd >= 0 )
+    {
+        close ( sockmap->verdict_fd );
+    }
+
+    if ( sockmap->moved_fd >= 0 )
+    {
+        close ( sockmap->moved_fd );
+    }
+
+    if ( sockmap->peers_fd >= 0 )
+    {
+        close ( sockmap->peers_fd );
+    }
+
+    if ( sockmap->sockmap_fd >= 0 )
+    {
+        close ( sockmap->sockmap_fd );
+    }
+
+    free ( sockmap->redirects );
+    free ( sockmap );
+    proxy->sockmap = NULL;
+}
+
+/**
+ * Check for data left to user space, lets data queued before mapping pass the verdict
+ */
+static int sockmap_peek ( int sock )
+{
+    char byte;
+
+    if ( recv ( sock, &byte, sizeof ( byte ), MSG_PEEK | MSG_DONTWAIT ) < 0
+        && ( errno == EAGAIN || errno == EWOULDBLOCK ) )
+    {
+        return 0;
+    }
+
+    return 1;
+}
+
+/**
+ * Get data redirected to the stream not yet given to its socket
+ */
+static size_t sockmap_pending ( struct proxy_sockmap_t *sockmap, struct stream_t *stream )
+{
+    uint64_t moved;
+    unsigned long long written;
+
+    if ( socket_bytes_written ( stream->fd, &written ) < 0 )
+    {
+        return 0;
+    }
+
+    /* Socket was given nothing else since mapping */
+    moved = sockmap->moved[stream->neighbour->index];
+    written -= sockmap->redirects[stream->index]->sent;
+
+    return moved > written ? moved - written : 0;
+}
+
+/**
+ * Stop redirecting data from the stream
+ */
+static int sockmap_disarm ( struct proxy_sockmap_t *sockmap, struct stream_t *stream )
+{
+    struct redirect_t *redirect = sockmap->redirects[stream->index];
+
+    if ( !redirect->armed )
+    {
+        return 0;
+    }
+
+    if ( sockmap_map_delete ( sockmap->peers_fd, &redirect->cookie ) < 0 )
+    {
+        failure ( "cannot disarm kernel relay of socket:%i (%i)\n", stream->fd, errno );
+        return -1;
+    }
+
+    redirect->armed = 0;
+
+    /* Socket lock waits out verdicts still running */
+    sockmap_peek ( stream->fd );
+
+    return 0;
+}
+
+/**
+ * Hand relation over to kernel relay
+ */
+int sockmap_attach ( struct proxy_t *proxy, struct stream_t *stream )
+{
+    int i;
+    int fd;
+    uint32_t key;
+    socklen_t len;
+    struct stream_t *pair[2];
+    struct redirect_t *redirect[2];
+    struct redirect_peer_t peer;
+    struct proxy_sockmap_t *sockmap = proxy->sockmap;
+
+    pair[0] = stream;
+    pair[1] = stream->neighbour;
+
+    /* Relation is tried once, with nothing held in user space */
+    for ( i = 0; i < 2; i++ )
+    {
+        if ( pair[i]->index >= sockmap->len || sockmap->redirects[pair[i]->index]
+            || pair[i]->queue || proxy->chunks[pair[i]->index]
+            || ( proxy->pipes && proxy->pipes[pair[i]->index] ) )
+        {
+            return 0;
+        }
+    }
+
+    for ( i = 0; i < 2; i++ )
+    {
+        if ( !( redirect[i] = ( struct redirect_t * ) calloc ( 1, sizeof ( struct redirect_t ) ) ) )
+        {
+            if ( i )
+            {
+                sockmap->redirects[pair[0]->index] = NULL;
+                free ( redirect[0] );
+            }
+            return 0;
+        }
+        redirect[i]->stream = pair[i];
+        redirect[i]->drained = 1;
+        sockmap->redirects[pair[i]->index] = redirect[i];
+    }
+
+    for ( i = 0; i < 2; i++ )
+    {
+        len = sizeof ( redirect[i]->cookie );
+        if ( getsockopt ( pair[i]->fd, SOL_SOCKET, SO_COOKIE, &redirect[i]->cookie, &len ) < 0
+            || socket_bytes_written ( pair[i]->fd, &redirect[i]->sent ) < 0 )
+        {
+            return 0;
+        }
+        sockmap->moved[pair[i]->index] = 0;
+    }
+
+    /* Peers go first, data stays with its socket until both are mapped */
+    for ( i = 0; i < 2; i++ )
+    {
+        peer.peer = pair[!i]->index;
+        peer.self = pair[i]->index;
+        if ( sockmap_map_update ( sockmap->peers_fd, &redirect[i]->cookie, &peer ) < 0 )
+        {
+            failure ( "cannot add socket:%i peer to kernel relay (%i)\n", pair[i]->fd, errno );
+            for ( ; i >= 0; i-- )
+            {
+                sockmap_map_delete ( sockmap->peers_fd, &redirect[i]->cookie );
+            }
+            return 0;
+        }
+        redirect[i]->armed = 1;
+    }
+
+    for ( i = 0; i < 2; i++ )
+    {
+        key = pair[i]->index;
+        fd = pair[i]->fd;
+        if ( sockmap_map_update ( sockmap->sockmap_fd, &key, &fd ) < 0 )
+        {
+            failure ( "cannot add socket:%i to kernel relay (%i)\n", pair[i]->fd, errno );
+            /* Nothing was redirected without the second socket */
+            if ( sockmap_disarm ( sockmap, pair[0] ) < 0
+                || sockmap_disarm ( sockmap, pair[1] ) < 0 )
+            {
+                return -1;
+            }
+            return 0;
+        }
+        redirect[i]->mapped = 1;
+    }
+
+    redirect[0]->drained = 0;
+    redirect[1]->drained = 0;
+
+    if ( ( redirect[0]->next = sockmap->head ) )
+    {
+        sockmap->head->prev = redirect[0];
+    }
+    sockmap->head = redirect[0];
+    sockmap->relations++;
+    proxy->stat_sockmap++;
+
+    /* Data passed before both sockets were mapped stays in user space */
+    for ( i = 0; i < 2; i++ )
+    {
+        if ( sockmap_peek ( pair[i]->fd ) )
+        {
+            if ( sockmap_disarm ( sockmap, pair[i] ) < 0 )
+            {
+                return -1;
+            }
+            if ( sockmap->moved[pair[i]->index] )
+            {
+                verbose ( "data from socket:%i was relayed in both kernel and user space\n",
+                    pair[i]->fd );
+                return -1;
+            }
+        }
+    }
+
+    verbose ( "relation of socket:%i and socket:%i is relayed in kernel\n", pair[0]->fd,
+        pair[1]->fd );
+
+    return 0;
+}
+
+/**
+ * Get kernel relayed data not yet given to the stream socket
+ */
+size_t sockmap_backlog ( struct proxy_t *proxy, struct stream_t *stream )
+{
+    size_t pending;
+    struct redirect_t *redirect;
+    struct proxy_sockmap_t *sockmap = proxy->sockmap;
+
+    if ( stream->index >= sockmap->len || !( redirect = sockmap->redirects[stream->index] )
+        || redirect->drained || !sockmap->redirects[stream->neighbour->index] )
+    {
+        return 0;
+    }
+
+    pending = sockmap_pending ( sockmap, stream );
+
+    /* Nothing more comes once the neighbour is disarmed */
+    if ( !pending && !sockmap->redirects[stream->neighbour->index]->armed )
+    {
+        redirect->drained = 1;
+    }
+
+    return pending;
+}
+
+/**
+ * Check if the stream socket is in the sockmap
+ */
+int sockmap_mapped ( struct proxy_t *proxy, const struct stream_t *stream )
+{
+    struct proxy_sockmap_t *sockmap = proxy->sockmap;
+
+    return stream->index < sockmap->len && sockmap->redirects[stream->index]
+        && sockmap->redirects[stream->index]->mapped;
+}
+
+/**
+ * Take stream out of kernel relay
+ */
+void sockmap_release ( struct proxy_t *proxy, struct stream_t *stream )
+{
+    uint32_t key;
+    struct redirect_t *redirect;
+    struct proxy_sockmap_t *sockmap = proxy->sockmap;
+
+    if ( stream->index >= sockmap->len || !( redirect = sockmap->redirects[stream->index] ) )
+    {
+        return;
+    }
+
+    if ( redirect->armed )
+    {
+        sockmap_map_delete ( sockmap->peers_fd, &redirect->cookie );
+    }
+
+    /* Closed socket may have left the sockmap already */
+    if ( redirect->mapped )
+    {
+        key = stream->index;
+        sockmap_map_delete ( sockmap->sockmap_fd, &key );
+    }
+
+    if ( redirect->prev || redirect->next || sockmap->head == redirect )
+    {
+        if ( redirect->prev )
+        {
+            redirect->prev->next = redirect->next;
+
+        } else
+        {
+            sockmap->head = redirect->next;
+        }
+
+        if ( redirect->next )
+        {
+            redirect->next->prev = redirect->prev;
+        }
+
+        sockmap->relations--;
+    }
+
+    sockmap->redirects[stream->index] = NULL;
+    free ( redirect );
+}
+
+/**
+ * Get count of relations in kernel relay
+ */
+size_t sockmap_relations ( struct proxy_t *proxy )
+{
+    return proxy->sockmap ? proxy->sockmap->relations : 0;
+}
+
+/**
+ * Take congested stream out of the sockmap, so its socket pushes back on the sender
+ */
+static int sockmap_demote ( struct proxy_t *proxy, struct stream_t *stream )
+{
+    uint32_t key;
+    struct redirect_t *redirect;
+    struct proxy_sockmap_t *sockmap = proxy->sockmap;
+
+    redirect = sockmap->redirects[stream->index];
+    redirect->congested = 1;
+
+    /* Leaving the sockmap drops what the kernel holds for the socket */
+    if ( sockmap_disarm ( sockmap, stream->neighbour ) < 0 )
+    {
+        return -1;
+    }
+
+    if ( sockmap_pending ( sockmap, stream ) )
+    {
+        return 0;
+    }
+
+    key = stream->index;
+    if ( sockmap_map_delete ( sockmap->sockmap_fd, &key ) < 0
+        || sockmap_map_delete ( sockmap->peers_fd, &redirect->cookie ) < 0 )
+    {
+        failure ( "cannot take socket:%i out of kernel relay (%i)\n", stream->fd, errno );
+        return -1;
+    }
+
+    redirect->mapped = 0;
+    redirect->armed = 0;
+    redirect->drained = 1;
+    redirect->congested = 0;
+
+    /* Socket lock waits out verdicts still running */
+    sockmap_peek ( stream->fd );
+    stream->readiness |= POLLIN;
+    proxy->stat_demoted++;
+
+    verbose ( "socket:%i is congested, relaying data from socket:%i in user space\n",
+        stream->neighbour->fd, stream->fd );
+
+    return 1;
+}
+
+/**
+ * Account data relayed in kernel and watch its backlog
+ */
+static int sockmap_account ( struct proxy_t *proxy, struct stream_t *relation )
+{
+    int i;
+    int status;
+    int resume = 0;
+    uint64_t moved;
+    unsigned long long delta;
+    struct stream_t *pair[2];
+    struct redirect_t *redirect;
+    struct proxy_sockmap_t *sockmap = proxy->sockmap;
+
+    pair[0] = relation;
+    pair[1] = relation->neighbour;
+
+    for ( i = 0; i < 2; i++ )
+    {
+        redirect = sockmap->redirects[pair[i]->index];
+        moved = sockmap->moved[pair[i]->index];
+
+        /* Kernel relayed data keeps the relation active */
+        if ( ( delta = moved - redirect->seen ) )
+        {
+            redirect->seen = moved;
+            relation->bytes += delta;
+            proxy->stat_forwarded += delta;
+            proxy->stat_redirected += delta;
+            relation->active = proxy->now / TIMER_TICK_MSEC;
+            stream_set_list ( proxy, relation, LIST_ESTABLISHED );
+        }
+
+        /* Backlog is checked after each half of its limit */
+        if ( redirect->congested || ( redirect->armed
+                && moved - redirect->checked >= SOCKMAP_BACKLOG_LIMIT / 2 ) )
+        {
+            redirect->checked = moved;
+            if ( redirect->congested
+                || sockmap_pending ( sockmap, pair[!i] ) > SOCKMAP_BACKLOG_LIMIT )
+            {
+                if ( ( status = sockmap_demote ( proxy, pair[i] ) ) < 0 )
+                {
+                    return -1;
+                }
+                resume |= status;
+            }
+        }
+    }
+
+    /* Data held back by kernel backlog has no events to wait for */
+    if ( resume || proxy->chunks[pair[0]->index] || proxy->chunks[pair[1]->index] )
+    {
+        return resume_forward_data ( proxy, relation );
+    }
+
+    return 0;
+}
+
+/**
+ * Account kernel relayed data and handle congested relations
+ */
+void sockmap_sweep ( struct proxy_t *proxy )
+{
+    unsigned long tick;
+    struct redirect_t *iter;
+    struct proxy_sockmap_t *sockmap = proxy->sockmap;
+
+    /* Relations are visited once per timer tick */
+    if ( sockmap->tick == ( tick = proxy->now / TIMER_TICK_MSEC ) )
+    {
+        return;
+    }
+
+    sockmap->tick = tick;
+
+    for ( iter = sockmap->head; iter; iter = iter->next )
+    {
+        if ( !iter->stream->abandoned && sockmap_account ( proxy, iter->stream ) < 0 )
+        {
+            remove_relation ( proxy, iter->stream );
+        }
+    }
+}
+
+#else
+
+/**
+ * Setup kernel relay maps and verdict program
+ */
+int sockmap_setup ( struct proxy_t *proxy )
+{
+    proxy->sockmap = NULL;
+
+    if ( proxy->kernel_relay )
+    {
+        failure ( "kernel relay not supported by build, forwarding in user space\n" );
+    }
+
+    return 0;
+}
+
+/**
+ * Release kernel relay maps and verdict program
+ */
+void sockmap_free ( struct proxy_t *proxy )
+{
+    UNUSED ( proxy );
+}
+
+/**
+ * Hand relation over to kernel relay
+ */
+int sockmap_attach ( struct proxy_t *proxy, struct stream_t *stream )
+{
+    UNUSED ( proxy );
+    UNUSED ( stream );
+    return 0;
+}
+
+/**
+ * Get kernel relayed data not yet given to the stream socket
+ */
+size_t sockmap_backlog ( struct proxy_t *proxy, struct stream_t *stream )
+{
+    UNUSED ( proxy );
+    UNUSED ( stream );
+    return 0;
+}
+
+/**
+ * Check if the stream socket is in the sockmap
+ */
+int sockmap_mapped ( struct proxy_t *proxy, const struct stream_t *stream )
+{
+    UNUSED ( proxy );
+    UNUSED ( stream );
+    return 0;
+}
+
+/**
+ * Take stream out of kernel relay
+ */
+void sockmap_release ( struct proxy_t *proxy, struct stream_t *stream )
+{
+    UNUSED ( proxy );
+    UNUSED ( stream );
+}
+
+/**
+ * Get count of relations in kernel relay
+ */
+size_t sockmap_relations ( struct proxy_t *proxy )
+{
+    UNUSED ( proxy );
+    return 0;
+}
+
+/**
+ * Account kernel relayed data and handle congested relations
+ */
+void sockmap_sweep ( struct proxy_t *proxy )
+{
+    UNUSED ( proxy );
+}
+
+#endif
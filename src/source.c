@@ -0,0 +1,413 @@
+/* ------------------------------------------------------------------
+ * Proxy Util - Client Source Table
+ * ------------------------------------------------------------------ */
+
+#define PROXY_UTIL_BASE_STRUCTS
+#include "util.h"
+
+/**
+ * Source entry states
+ */
+#define SOURCE_EMPTY                0
+#define SOURCE_USED                 1
+#define SOURCE_DELETED              2
+
+/**
+ * Token units per handshake
+ */
+#define SOURCE_TOKEN                1000
+
+/**
+ * Client source address table entry
+ */
+struct source_t
+{
+    uint64_t prefix;
+    unsigned long long stamp;
+    unsigned int conns;
+    unsigned int tokens;
+    unsigned char state;
+    unsigned char family;
+};
+
+/**
+ * Setup client source table sized by connections limit
+ */
+int source_table_setup ( struct proxy_t *proxy )
+{
+    size_t capacity;
+
+    proxy->sources = NULL;
+    proxy->source_mask = 0;
+    proxy->source_used = 0;
+    proxy->source_tombs = 0;
+    proxy->source_rebuilt = 0;
+
+    if ( !proxy->source_conns && !proxy->source_rate )
+    {
+        return 0;
+    }
+
+    /* Keep load below one half with every client from another source */
+    for ( capacity = SOURCE_TABLE_MIN; capacity < proxy->max_conns * 2; capacity <<= 1 );
+
+    if ( !( proxy->sources = ( struct source_t * ) calloc ( capacity,
+                sizeof ( struct source_t ) ) ) )
+    {
+        return -1;
+    }
+
+    proxy->source_mask = capacity - 1;
+
+    verbose ( "source table setup with %lu entries\n", ( unsigned long ) capacity );
+
+    return 0;
+}
+
+/**
+ * Release client source table
+ */
+void source_table_free ( struct proxy_t *proxy )
+{
+    free ( proxy->sources );
+    proxy->sources = NULL;
+    proxy->source_mask = 0;
+    proxy->source_used = 0;
+    proxy->source_tombs = 0;
+    proxy->source_rebuilt = 0;
+}
+
+/**
+ * Extract client source prefix from the address
+ */
+static int source_key ( const struct sockaddr_storage *saddr, unsigned char *family,
+    uint64_t * prefix )
+{
+    size_t i;
+    const uint8_t *addr;
+
+    if ( saddr->ss_family == AF_INET )
+    {
+        *family = 4;
+        *prefix = ntohl ( ( ( const struct sockaddr_in * ) saddr )->sin_addr.s_addr );
+
+    } else if ( saddr->ss_family == AF_INET6 )
+    {
+        addr = ( ( const struct sockaddr_in6 * ) saddr )->sin6_addr.s6_addr;
+
+        /* IPv4 clients of dual-stack listener share IPv4 entries */
+        if ( IN6_IS_ADDR_V4MAPPED ( &( ( const struct sockaddr_in6 * ) saddr )->sin6_addr ) )
+        {
+            *family = 4;
+            *prefix = ( ( uint64_t ) addr[12] << 24 ) | ( ( uint64_t ) addr[13] << 16 )
+                | ( ( uint64_t ) addr[14] << 8 ) | addr[15];
+
+        } else
+        {
+            *family = 6;
+            for ( *prefix = 0, i = 0; i < 8; i++ )
+            {
+                *prefix = ( *prefix << 8 ) | addr[i];
+            }
+        }
+
+    } else
+    {
+        return -1;
+    }
+
+    /* Hosts in one prefix count as one source */
+    if ( *family == 4 )
+    {
+        *prefix &= ( 0xffffffffULL << ( 32 - SOURCE_PREFIX_V4 ) ) & 0xffffffffULL;
+
+    } else if ( SOURCE_PREFIX_V6 < 64 )
+    {
+        *prefix &= ~0ULL << ( 64 - SOURCE_PREFIX_V6 );
+    }
+
+    return 0;
+}
+
+/**
+ * Hash client source prefix
+ */
+static size_t source_hash ( unsigned char family, uint64_t prefix )
+{
+    uint64_t hash = prefix ^ ( ( uint64_t ) family << 56 );
+
+    hash ^= hash >> 33;
+    hash *= 0xff51afd7ed558ccdULL;
+    hash ^= hash >> 33;
+    hash *= 0xc4ceb9fe1a85ec53ULL;
+    hash ^= hash >> 33;
+
+    return ( size_t ) hash;
+}
+
+/**
+ * Add handshake tokens earned since the last refill
+ */
+static void source_refill ( struct proxy_t *proxy, struct source_t *entry )
+{
+    unsigned long long earned;
+    unsigned long long capacity;
+
+    capacity = ( unsigned long long ) proxy->source_rate * SOURCE_TOKEN;
+
+    if ( proxy->now > entry->stamp )
+    {
+        /* Rate is given per second, token units make it per millisecond */
+        earned = ( proxy->now - entry->stamp ) * proxy->source_rate;
+        entry->tokens = earned >= capacity - entry->tokens ? capacity : entry->tokens + earned;
+        entry->stamp = proxy->now;
+    }
+}
+
+/**
+ * Check if source entry holds nothing worth remembering
+ */
+static int source_idle ( struct proxy_t *proxy, struct source_t *entry )
+{
+    if ( entry->conns )
+    {
+        return 0;
+    }
+
+    if ( proxy->source_rate )
+    {
+        source_refill ( proxy, entry );
+        return entry->tokens >= ( unsigned long long ) proxy->source_rate * SOURCE_TOKEN;
+    }
+
+    return 1;
+}
+
+/**
+ * Find source entry index, optionally inserting a new one
+ */
+static ssize_t source_find ( struct proxy_t *proxy, unsigned char family, uint64_t prefix,
+    int insert )
+{
+    size_t i;
+    size_t probe;
+    ssize_t deleted = -1;
+    struct source_t *entry;
+
+    /* Linear probing stops at the first never used entry */
+    for ( i = source_hash ( family, prefix ) & proxy->source_mask, probe = 0;
+        probe <= proxy->source_mask; i = ( i + 1 ) & proxy->source_mask, probe++ )
+    {
+        entry = &proxy->sources[i];
+
+        if ( entry->state == SOURCE_EMPTY )
+        {
+            break;
+        }
+
+        if ( entry->state == SOURCE_DELETED )
+        {
+            if ( deleted < 0 )
+            {
+                deleted = i;
+            }
+            continue;
+        }
+
+        if ( entry->family == family && entry->prefix == prefix )
+        {
+            return i;
+        }
+    }
+
+    if ( !insert )
+    {
+        return -1;
+    }
+
+    /* Reuse deleted entry found on the way */
+    if ( deleted >= 0 )
+    {
+        i = deleted;
+        proxy->source_tombs--;
+
+    } else if ( proxy->sources[i].state != SOURCE_EMPTY )
+    {
+        return -1;
+    }
+
+    entry = &proxy->sources[i];
+    entry->state = SOURCE_USED;
+    entry->family = family;
+    entry->prefix = prefix;
+    entry->conns = 0;
+    entry->tokens = proxy->source_rate * SOURCE_TOKEN;
+    entry->stamp = proxy->now;
+    proxy->source_used++;
+
+    return i;
+}
+
+/**
+ * Rehash source table dropping deleted and idle entries
+ */
+static void source_table_rebuild ( struct proxy_t *proxy )
+{
+    int list;
+    int forget;
+    size_t i;
+    ssize_t index;
+    struct source_t *entry;
+    struct source_t *previous;
+    struct stream_t *iter;
+
+    previous = proxy->sources;
+
+    if ( !( proxy->sources = ( struct source_t * ) calloc ( proxy->source_mask + 1,
+                sizeof ( struct source_t ) ) ) )
+    {
+        /* Keep probing the old table */
+        proxy->sources = previous;
+        proxy->source_rebuilt = proxy->source_used + proxy->source_tombs;
+        failure ( "cannot rebuild source table (%i)\n", errno );
+        return;
+    }
+
+    proxy->source_used = 0;
+    proxy->source_tombs = 0;
+    proxy->source_rebuilt = 0;
+
+    /* Forget rate history too, if needed to keep the table sparse */
+    for ( forget = 0, i = 0; i <= proxy->source_mask; i++ )
+    {
+        entry = &previous[i];
+        if ( entry->state == SOURCE_USED && !source_idle ( proxy, entry ) && !entry->conns )
+        {
+            forget++;
+        }
+    }
+    forget = forget > ( int ) ( proxy->source_mask + 1 ) / 4;
+
+    for ( i = 0; i <= proxy->source_mask; i++ )
+    {
+        entry = &previous[i];
+        if ( entry->state != SOURCE_USED || source_idle ( proxy, entry )
+            || ( forget && !entry->conns ) )
+        {
+            continue;
+        }
+        if ( ( index = source_find ( proxy, entry->family, entry->prefix, 1 ) ) >= 0 )
+        {
+            proxy->sources[index] = *entry;
+        }
+    }
+
+    /* Point connected clients to moved entries */
+    for ( list = 0; list < STREAM_LISTS; list++ )
+    {
+        for ( iter = proxy->stream_head[list]; iter; iter = iter->next )
+        {
+            if ( iter->source )
+            {
+                entry = &previous[iter->source - 1];
+                index = source_find ( proxy, entry->family, entry->prefix, 0 );
+                iter->source = index >= 0 ? index + 1 : 0;
+            }
+        }
+    }
+
+    free ( previous );
+
+    proxy->source_rebuilt = proxy->source_used;
+
+    verbose ( "source table rebuilt with %lu entries in use\n",
+        ( unsigned long ) proxy->source_used );
+}
+
+/**
+ * Account new client in its source entry, fail if over the limits
+ */
+int source_admit ( struct proxy_t *proxy, struct stream_t *stream,
+    const struct sockaddr_storage *saddr )
+{
+    unsigned char family;
+    uint64_t prefix;
+    size_t load;
+    ssize_t index;
+    struct source_t *entry;
+
+    if ( !proxy->sources || source_key ( saddr, &family, &prefix ) < 0 )
+    {
+        return 0;
+    }
+
+    /* Deleted entries lengthen probes, clean up at three quarters load */
+    load = proxy->source_used + proxy->source_tombs;
+
+    /* Live entries alone may hold that load, so rebuild again only after an eighth more */
+    if ( load * 4 >= ( proxy->source_mask + 1 ) * 3
+        && ( load - proxy->source_rebuilt ) * 8 >= proxy->source_mask + 1 )
+    {
+        source_table_rebuild ( proxy );
+    }
+
+    if ( ( index = source_find ( proxy, family, prefix, 1 ) ) < 0 )
+    {
+        /* Table is full, let the client in untracked */
+        return 0;
+    }
+
+    entry = &proxy->sources[index];
+
+    if ( proxy->source_conns && entry->conns >= ( unsigned long ) proxy->source_conns )
+    {
+        verbose ( "source has %u connection(s), refusing socket:%i\n", entry->conns,
+            stream->fd );
+        return -1;
+    }
+
+    if ( proxy->source_rate )
+    {
+        source_refill ( proxy, entry );
+        if ( entry->tokens < SOURCE_TOKEN )
+        {
+            verbose ( "source handshake rate exceeded, refusing socket:%i\n", stream->fd );
+            return -1;
+        }
+        entry->tokens -= SOURCE_TOKEN;
+    }
+
+    entry->conns++;
+    stream->source = index + 1;
+
+    return 0;
+}
+
+/**
+ * Release client from its source entry
+ */
+void source_release ( struct proxy_t *proxy, struct stream_t *stream )
+{
+    struct source_t *entry;
+
+    if ( !stream->source || !proxy->sources )
+    {
+        return;
+    }
+
+    entry = &proxy->sources[stream->source - 1];
+    stream->source = 0;
+
+    if ( entry->conns )
+    {
+        entry->conns--;
+    }
+
+    /* Source entry holding no state can be deleted right away */
+    if ( source_idle ( proxy, entry ) )
+    {
+        entry->state = SOURCE_DELETED;
+        proxy->source_used--;
+        proxy->source_tombs++;
+    }
+}
@@ -4,16 +4,90 @@
 
 #include "axproxy.h"
 
+/**
+ * Program long options
+ */
+static const struct option long_options[] = {
+    {"verbose", no_argument, NULL, 'v'},
+    {"daemon", no_argument, NULL, 'd'},
+    {"workers", required_argument, NULL, 'w'},
+    {"pin-cpus", no_argument, NULL, 'p'},
+    {"edge-triggered", no_argument, NULL, 'e'},
+    {"uring-poll", no_argument, NULL, 'u'},
+    {"io-uring", no_argument, NULL, 'u'},
+    {"splice", no_argument, NULL, 'z'},
+    {"sockmap", no_argument, NULL, 'k'},
+    {"fast-open", no_argument, NULL, 'f'},
+    {"max-conns", required_argument, NULL, 'm'},
+    {"idle-timeout", required_argument, NULL, 'i'},
+    {"backlog", required_argument, NULL, 'b'},
+    {"defer-accept", required_argument, NULL, 'a'},
+    {"stall-threshold", required_argument, NULL, 's'},
+    {"shed-occupancy", required_argument, NULL, 'o'},
+    {"shed-lag", required_argument, NULL, 'l'},
+    {"source-conns", required_argument, NULL, 'c'},
+    {"source-rate", required_argument, NULL, 'r'},
+    {"autotune", required_argument, NULL, 't'},
+    {"prioritize", required_argument, NULL, 'q'},
+    {"busy-poll", required_argument, NULL, 'y'},
+    {"profile", required_argument, NULL, 'n'},
+    {NULL, 0, NULL, 0}
+};
+
 /**
  * Show program usage message
  */
 static void show_usage ( void )
 {
-    failure ( "usage: axproxy [-vd] listen-addr:listen-port\n\n"
+    failure ( "usage: axproxy [-vdpeuzkf] [-w workers] [-m max-conns] [-i seconds]\n"
+        "              [-b backlog] [-a seconds] [-s msec] [-o percent] [-l msec]\n"
+        "              [-c count] [-r rate] [-t megabytes] [-q tos]\n"
+        "              [-y usec] [-n profile]\n"
+        "              listen-addr:listen-port\n\n"
         "       option -v         Enable verbose logging\n"
         "       option -d         Run in background\n"
+        "       option -w count   Run count worker loops (up to %i)\n"
+        "       option -p         Pin workers to CPUs and steer by incoming CPU\n"
+        "       option -e         Use edge-triggered epoll for relations\n"
+        "       option -u         Wait for readiness with io_uring if available\n"
+        "       option -z         Relay data with splice through pipes\n"
+        "       option -k         Relay data in kernel with BPF sockmap\n"
+        "       option -f         Use TCP fast open, send early data with the SYN\n"
+        "       option -m count   Accept up to count connections per worker\n"
+        "       option -i seconds Close relations idle for seconds, 0 never (default %i)\n"
+        "       option -b backlog Listen backlog length (default %i)\n"
+        "       option -a seconds Accept only once data arrives, wait up to seconds\n"
+        "       option -s msec    Log loop stalls above msec, 0 never (default %i)\n"
+        "       option -o percent Refuse requests above pool occupancy, 0 never (default %i)\n"
+        "       option -l msec    Refuse clients above loop lag, 0 never (default %i)\n"
+        "       option -c count   Allow up to count connections per client address\n"
+        "       option -r rate    Allow up to rate new connections/s per client address\n"
+        "       option -t megabytes Tune relation buffers to path, using up to megabytes\n"
+        "       option -q tos     Serve interactive relations first, mark with tos, 0 none\n"
+        "       option -y usec    Busy poll sockets up to usec before sleeping\n"
+        "       option -n profile Tune relation sockets by destination, repeatable\n"
         "       listen-addr       Listen address\n"
-        "       listen-port       Listen port\n\n" "Note: Both IPv4 and IPv6 can be used\n\n" );
+        "       listen-port       Listen port\n\n" "Note: Both IPv4 and IPv6 can be used\n\n",
+        WORKERS_LIMIT, IDLE_TIMEOUT_SEC, LISTEN_BACKLOG, LOOP_STALL_MSEC,
+        SHED_OCCUPANCY_PCT, SHED_LAG_MSEC );
+}
+
+/**
+ * Parse numeric option value
+ */
+static int parse_option_number ( const char *str, long min, long max, long *value )
+{
+    char *end;
+
+    errno = 0;
+    *value = strtol ( str, &end, 10 );
+
+    if ( errno || end == str || *end || *value < min || *value > max )
+    {
+        return -1;
+    }
+
+    return 0;
 }
 
 /**
@@ -21,37 +95,181 @@ static void show_usage ( void )
  */
 int main ( int argc, char *argv[] )
 {
-    int arg_off = 0;
+    int opt;
+    int status;
+    long value;
     int daemon_flag = 0;
     struct proxy_t proxy = { 0 };
 
     /* Show program version */
     info ( "AxProxy - ver. " AXPROXY_VERSION "\n" );
 
-    /* Validate arguments count */
-    if ( argc < 2 )
-    {
-        show_usage (  );
-        return 1;
-    }
+    /* Listen socket is created by the task */
+    proxy.listen_fd = -1;
+    proxy.worker_cpu = -1;
+    proxy.idle_timeout = IDLE_TIMEOUT_SEC;
+    proxy.listen_backlog = LISTEN_BACKLOG;
+    proxy.stall_threshold = LOOP_STALL_MSEC;
+    proxy.shed_occupancy = SHED_OCCUPANCY_PCT;
+    proxy.shed_lag = SHED_LAG_MSEC;
 
-    /* Check for options */
-    if ( argv[1][0] == '-' )
+    /* Parse options */
+    while ( ( opt = getopt_long ( argc, argv, "vdpeuzkfw:m:i:b:a:s:o:l:c:r:t:q:y:n:", long_options,
+                NULL ) ) != -1 )
     {
-        arg_off = 1;
-        proxy.verbose = !!strchr ( argv[1], 'v' );
-        daemon_flag = !!strchr ( argv[1], 'd' );
+        switch ( opt )
+        {
+        case 'v':
+            proxy.verbose = 1;
+            break;
+        case 'd':
+            daemon_flag = 1;
+            break;
+        case 'p':
+            proxy.cpu_pinning = 1;
+            break;
+        case 'e':
+            proxy.edge_triggered = 1;
+            break;
+        case 'u':
+            proxy.io_uring = 1;
+            break;
+        case 'z':
+            proxy.splice = 1;
+            break;
+        case 'k':
+            proxy.kernel_relay = 1;
+            break;
+        case 'f':
+            proxy.fast_open = 1;
+            break;
+        case 'w':
+            if ( parse_option_number ( optarg, 1, WORKERS_LIMIT, &value ) < 0 )
+            {
+                show_usage (  );
+                return 1;
+            }
+            proxy.workers = value;
+            break;
+        case 'm':
+            if ( parse_option_number ( optarg, 1, MAX_CONNS_LIMIT, &value ) < 0 )
+            {
+                show_usage (  );
+                return 1;
+            }
+            proxy.max_conns = value;
+            break;
+        case 'i':
+            if ( parse_option_number ( optarg, 0, IDLE_TIMEOUT_LIMIT, &value ) < 0 )
+            {
+                show_usage (  );
+                return 1;
+            }
+            proxy.idle_timeout = value;
+            break;
+        case 'b':
+            if ( parse_option_number ( optarg, 1, LISTEN_BACKLOG_LIMIT, &value ) < 0 )
+            {
+                show_usage (  );
+                return 1;
+            }
+            proxy.listen_backlog = value;
+            break;
+        case 'a':
+            if ( parse_option_number ( optarg, 1, DEFER_ACCEPT_LIMIT, &value ) < 0 )
+            {
+                show_usage (  );
+                return 1;
+            }
+            proxy.defer_accept = value;
+            break;
+        case 's':
+            if ( parse_option_number ( optarg, 0, LOOP_STALL_LIMIT, &value ) < 0 )
+            {
+                show_usage (  );
+                return 1;
+            }
+            proxy.stall_threshold = value;
+            break;
+        case 'o':
+            if ( parse_option_number ( optarg, 0, 100, &value ) < 0 )
+            {
+                show_usage (  );
+                return 1;
+            }
+            proxy.shed_occupancy = value;
+            break;
+        case 'l':
+            if ( parse_option_number ( optarg, 0, LOOP_STALL_LIMIT, &value ) < 0 )
+            {
+                show_usage (  );
+                return 1;
+            }
+            proxy.shed_lag = value;
+            break;
+        case 'c':
+            if ( parse_option_number ( optarg, 1, SOURCE_CONNS_LIMIT, &value ) < 0 )
+            {
+                show_usage (  );
+                return 1;
+            }
+            proxy.source_conns = value;
+            break;
+        case 'r':
+            if ( parse_option_number ( optarg, 1, SOURCE_RATE_LIMIT, &value ) < 0 )
+            {
+                show_usage (  );
+                return 1;
+            }
+            proxy.source_rate = value;
+            break;
+        case 't':
+            if ( parse_option_number ( optarg, 1, TUNE_MEMORY_LIMIT, &value ) < 0 )
+            {
+                show_usage (  );
+                return 1;
+            }
+            proxy.tune_limit = ( size_t ) value << 20;
+            break;
+        case 'q':
+            if ( parse_option_number ( optarg, 0, 255, &value ) < 0 )
+            {
+                show_usage (  );
+                return 1;
+            }
+            proxy.prioritize = 1;
+            proxy.interactive_tos = value;
+            break;
+        case 'y':
+            if ( parse_option_number ( optarg, 1, BUSY_POLL_LIMIT, &value ) < 0 )
+            {
+                show_usage (  );
+                return 1;
+            }
+            proxy.busy_poll = value;
+            break;
+        case 'n':
+            if ( profile_add ( &proxy, optarg ) < 0 )
+            {
+                show_usage (  );
+                return 1;
+            }
+            break;
+        default:
+            show_usage (  );
+            return 1;
+        }
     }
 
-    /* Re-validate arguments count */
-    if ( argc < arg_off + 2 )
+    /* Validate arguments count */
+    if ( optind + 1 != argc )
     {
         show_usage (  );
         return 1;
     }
 
     /* Parse listen address and port */
-    if ( ip_port_decode ( argv[arg_off + 1], &proxy.entrance ) < 0 )
+    if ( ip_port_decode ( argv[optind], &proxy.entrance ) < 0 )
     {
         show_usage (  );
         return 1;
@@ -68,7 +286,9 @@ int main ( int argc, char *argv[] )
     }
 
     /* Launch the proxy task */
-    if ( proxy_task ( &proxy ) < 0 )
+    status = proxy.workers || proxy.cpu_pinning ? proxy_workers ( &proxy ) : proxy_task ( &proxy );
+
+    if ( status < 0 )
     {
         failure ( "exit status: %i\n", errno );
         return 1;
@@ -0,0 +1,658 @@
+/* ------------------------------------------------------------------
+ * Proxy Util - UDP Associations
+ * ------------------------------------------------------------------ */
+
+#define PROXY_UTIL_BASE_STRUCTS
+#include "util.h"
+
+/**
+ * SOCKS5 UDP header room, reserved version, fragment, address type,
+ * IPv6 address and port
+ */
+#define UDP_HEADER_ROOM             22
+
+/**
+ * Peer address key, IPv4 in mapped form
+ */
+struct udp_key_t
+{
+    uint8_t addr[16];
+    uint16_t port;
+};
+
+/**
+ * Association peer table entry
+ */
+struct udp_peer_t
+{
+    struct udp_key_t key;
+    unsigned int stamp;
+    unsigned char used;
+};
+
+/**
+ * Association state
+ */
+struct udp_assoc_t
+{
+    int family;
+    struct udp_key_t client;
+    struct sockaddr_storage client_addr;
+    struct udp_peer_t peers[UDP_PEER_SLOTS];
+};
+
+/**
+ * Datagram batch buffers
+ */
+struct proxy_udp_t
+{
+    struct udp_assoc_t **assocs;
+    struct mmsghdr in[UDP_BATCH];
+    struct iovec in_iov[UDP_BATCH];
+    struct sockaddr_storage in_addr[UDP_BATCH];
+    struct mmsghdr out[UDP_BATCH];
+    struct iovec out_iov[UDP_BATCH];
+    struct sockaddr_storage out_addr[UDP_BATCH];
+    uint8_t arr[UDP_BATCH][UDP_HEADER_ROOM + UDP_DATAGRAM_MAX];
+};
+
+/**
+ * Take peer key from socket address
+ */
+static int udp_key ( const struct sockaddr_storage *saddr, struct udp_key_t *key )
+{
+    if ( saddr->ss_family == AF_INET )
+    {
+        memset ( key->addr, '\0', 10 );
+        key->addr[10] = 0xff;
+        key->addr[11] = 0xff;
+        memcpy ( key->addr + 12, &( ( const struct sockaddr_in * ) saddr )->sin_addr, 4 );
+        key->port = ( ( const struct sockaddr_in * ) saddr )->sin_port;
+
+    } else if ( saddr->ss_family == AF_INET6 )
+    {
+        memcpy ( key->addr, &( ( const struct sockaddr_in6 * ) saddr )->sin6_addr, 16 );
+        key->port = ( ( const struct sockaddr_in6 * ) saddr )->sin6_port;
+
+    } else
+    {
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * Build socket address of the association family from peer key
+ */
+static socklen_t udp_key_addr ( int family, const struct udp_key_t *key,
+    struct sockaddr_storage *saddr )
+{
+    struct sockaddr_in *saddr_in;
+    struct sockaddr_in6 *saddr_in6;
+
+    if ( family == AF_INET6 )
+    {
+        saddr_in6 = ( struct sockaddr_in6 * ) saddr;
+        memset ( saddr_in6, '\0', sizeof ( struct sockaddr_in6 ) );
+        saddr_in6->sin6_family = AF_INET6;
+        memcpy ( &saddr_in6->sin6_addr, key->addr, 16 );
+        saddr_in6->sin6_port = key->port;
+        return sizeof ( struct sockaddr_in6 );
+    }
+
+    /* IPv6 peers cannot be reached from IPv4 socket */
+    if ( !IN6_IS_ADDR_V4MAPPED ( ( const struct in6_addr * ) key->addr ) )
+    {
+        return 0;
+    }
+
+    saddr_in = ( struct sockaddr_in * ) saddr;
+    memset ( saddr_in, '\0', sizeof ( struct sockaddr_in ) );
+    saddr_in->sin_family = AF_INET;
+    memcpy ( &saddr_in->sin_addr, key->addr + 12, 4 );
+    saddr_in->sin_port = key->port;
+    return sizeof ( struct sockaddr_in );
+}
+
+/**
+ * Hash peer key
+ */
+static unsigned int udp_key_hash ( const struct udp_key_t *key )
+{
+    size_t i;
+    uint32_t hash = 2166136261u;
+
+    for ( i = 0; i < sizeof ( key->addr ); i++ )
+    {
+        hash = ( hash ^ key->addr[i] ) * 16777619u;
+    }
+
+    hash = ( hash ^ key->port ) * 16777619u;
+
+    return hash ^ hash >> 16;
+}
+
+/**
+ * Find peer the client sent to
+ */
+static struct udp_peer_t *udp_peer_find ( struct udp_assoc_t *assoc, const struct udp_key_t *key )
+{
+    unsigned int i;
+    unsigned int hash = udp_key_hash ( key );
+    struct udp_peer_t *peer;
+
+    for ( i = 0; i < UDP_PEER_PROBE; i++ )
+    {
+        peer = assoc->peers + ( ( hash + i ) & ( UDP_PEER_SLOTS - 1 ) );
+
+        if ( !peer->used )
+        {
+            return NULL;
+        }
+
+        if ( !memcmp ( &peer->key, key, sizeof ( *key ) ) )
+        {
+            return peer;
+        }
+    }
+
+    return NULL;
+}
+
+/**
+ * Let replies of the peer in, the longest silent of probed peers makes room
+ */
+static void udp_peer_add ( struct proxy_t *proxy, struct udp_assoc_t *assoc,
+    const struct udp_key_t *key )
+{
+    unsigned int i;
+    unsigned int hash = udp_key_hash ( key );
+    unsigned int tick = proxy->now / TIMER_TICK_MSEC;
+    struct udp_peer_t *peer;
+    struct udp_peer_t *victim = NULL;
+
+    for ( i = 0; i < UDP_PEER_PROBE; i++ )
+    {
+        peer = assoc->peers + ( ( hash + i ) & ( UDP_PEER_SLOTS - 1 ) );
+
+        if ( !peer->used || !memcmp ( &peer->key, key, sizeof ( *key ) ) )
+        {
+            victim = peer;
+            break;
+        }
+
+        if ( !victim || tick - peer->stamp > tick - victim->stamp )
+        {
+            victim = peer;
+        }
+    }
+
+    victim->key = *key;
+    victim->stamp = tick;
+    victim->used = 1;
+}
+
+/**
+ * Create association socket next to the control connection, reply address goes to saddr
+ */
+int udp_associate ( struct proxy_t *proxy, struct stream_t *stream, uint16_t port,
+    struct sockaddr_storage *saddr )
+{
+    int sock;
+    int value;
+    socklen_t len;
+    struct stream_t *assoc_stream;
+    struct udp_assoc_t *assoc;
+    struct sockaddr_storage peer;
+
+    /* Batch buffers are taken with the first association */
+    if ( !proxy->udp )
+    {
+        if ( !( proxy->udp = ( struct proxy_udp_t * ) calloc ( 1, sizeof ( struct proxy_udp_t ) ) )
+            || !( proxy->udp->assocs = ( struct udp_assoc_t ** ) calloc ( proxy->stream_limit,
+                    sizeof ( struct udp_assoc_t * ) ) ) )
+        {
+            free ( proxy->udp );
+            proxy->udp = NULL;
+            return -1;
+        }
+
+        verbose ( "udp batch buffers setup for %i datagram(s)\n", UDP_BATCH );
+    }
+
+    /* Bind to the address the client reached */
+    len = sizeof ( *saddr );
+    if ( getsockname ( stream->fd, ( struct sockaddr * ) saddr, &len ) < 0 )
+    {
+        return -1;
+    }
+
+    len = sizeof ( peer );
+    if ( getpeername ( stream->fd, ( struct sockaddr * ) &peer, &len ) < 0 )
+    {
+        return -1;
+    }
+
+    if ( saddr->ss_family == AF_INET )
+    {
+        ( ( struct sockaddr_in * ) saddr )->sin_port = 0;
+
+    } else if ( saddr->ss_family == AF_INET6 )
+    {
+        ( ( struct sockaddr_in6 * ) saddr )->sin6_port = 0;
+
+    } else
+    {
+        return -1;
+    }
+
+    if ( !( assoc = ( struct udp_assoc_t * ) calloc ( 1, sizeof ( struct udp_assoc_t ) ) ) )
+    {
+        return -1;
+    }
+
+    assoc->family = saddr->ss_family;
+    udp_key ( &peer, &assoc->client );
+    assoc->client.port = port;
+    if ( port )
+    {
+        udp_key_addr ( assoc->family, &assoc->client, &assoc->client_addr );
+    }
+
+    if ( ( sock = socket ( saddr->ss_family, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC,
+                0 ) ) < 0 )
+    {
+        failure ( "cannot create udp socket (%i)\n", errno );
+        free ( assoc );
+        return -1;
+    }
+
+    /* IPv4 peers are reached through mapped addresses */
+    value = 0;
+    if ( saddr->ss_family == AF_INET6
+        && setsockopt ( sock, IPPROTO_IPV6, IPV6_V6ONLY, &value, sizeof ( value ) ) < 0 )
+    {
+        verbose ( "cannot set socket:%i dual stack (%i)\n", sock, errno );
+    }
+
+    /* Datagram bursts wait in the socket until the batch is read */
+    value = UDP_SOCKET_BUFFER;
+    if ( setsockopt ( sock, SOL_SOCKET, SO_RCVBUF, &value, sizeof ( value ) ) < 0
+        || setsockopt ( sock, SOL_SOCKET, SO_SNDBUF, &value, sizeof ( value ) ) < 0 )
+    {
+        verbose ( "cannot set socket:%i buffers (%i)\n", sock, errno );
+    }
+
+    len = sizeof ( *saddr );
+    if ( bind ( sock, ( const struct sockaddr * ) saddr, saddr->ss_family == AF_INET
+            ? sizeof ( struct sockaddr_in ) : sizeof ( struct sockaddr_in6 ) ) < 0
+        || getsockname ( sock, ( struct sockaddr * ) saddr, &len ) < 0 )
+    {
+        failure ( "cannot bind udp socket:%i (%i)\n", sock, errno );
+        close ( sock );
+        free ( assoc );
+        return -1;
+    }
+
+    /* Try allocating association stream */
+    if ( !( assoc_stream = insert_stream ( proxy, sock ) ) )
+    {
+        force_cleanup ( proxy, stream );
+        assoc_stream = insert_stream ( proxy, sock );
+    }
+
+    if ( !assoc_stream )
+    {
+        close ( sock );
+        free ( assoc );
+        return -1;
+    }
+
+    proxy->udp->assocs[assoc_stream->index] = assoc;
+
+    /* Association lives as long as the control connection */
+    assoc_stream->role = S_PORT_U;
+    assoc_stream->level = LEVEL_ASSOCIATED;
+    assoc_stream->neighbour = stream;
+    stream->neighbour = assoc_stream;
+    stream->level = LEVEL_ASSOCIATED;
+    stream_set_events ( proxy, assoc_stream, POLLIN );
+
+    /* Idle deadline is kept by the association side */
+    stream_set_list ( proxy, stream, LIST_OTHER );
+    stream_set_list ( proxy, assoc_stream, LIST_ESTABLISHED );
+    stream_clear_timer ( proxy, stream );
+    if ( proxy->idle_timeout )
+    {
+        stream_set_timer ( proxy, assoc_stream, proxy->idle_timeout * 1000 );
+    }
+
+    proxy->stat_associations++;
+
+    verbose ( "new udp association with socket:%i for socket:%i\n", sock, stream->fd );
+
+    return 0;
+}
+
+/**
+ * Release association state
+ */
+void udp_release ( struct proxy_t *proxy, struct stream_t *stream )
+{
+    free ( proxy->udp->assocs[stream->index] );
+    proxy->udp->assocs[stream->index] = NULL;
+}
+
+/**
+ * Release datagram batch buffers
+ */
+void udp_free ( struct proxy_t *proxy )
+{
+    if ( proxy->udp )
+    {
+        free ( proxy->udp->assocs );
+        free ( proxy->udp );
+        proxy->udp = NULL;
+    }
+}
+
+/**
+ * Queue client datagram to the peer named by its header, payload is not moved
+ */
+static int udp_from_client ( struct proxy_t *proxy, struct udp_assoc_t *assoc,
+    uint8_t * arr, size_t len, size_t out )
+{
+    size_t hdrlen;
+    uint32_t addr;
+    char hostname[256];
+    struct udp_key_t key;
+    struct proxy_udp_t *udp = proxy->udp;
+
+    /* Fragments are not reassembled */
+    if ( len < 4 || arr[0] || arr[1] || arr[2] )
+    {
+        return -1;
+    }
+
+    if ( arr[3] == 1 && len >= 10 )
+    {
+        memset ( key.addr, '\0', 10 );
+        key.addr[10] = 0xff;
+        key.addr[11] = 0xff;
+        memcpy ( key.addr + 12, arr + 4, 4 );
+        hdrlen = 10;
+
+    } else if ( arr[3] == 4 && len >= 22 )
+    {
+        memcpy ( key.addr, arr + 4, 16 );
+        hdrlen = 22;
+
+    } else if ( arr[3] == 3 && len >= 5 && len >= ( size_t ) arr[4] + 7 )
+    {
+        memcpy ( hostname, arr + 5, arr[4] );
+        hostname[arr[4]] = '\0';
+
+        if ( nsaddr_cached ( hostname, &addr ) < 0 )
+        {
+            verbose ( "failed to resolve udp peer by hostname (%s)\n", hostname );
+            return -1;
+        }
+
+        memset ( key.addr, '\0', 10 );
+        key.addr[10] = 0xff;
+        key.addr[11] = 0xff;
+        memcpy ( key.addr + 12, &addr, 4 );
+        hdrlen = arr[4] + 7;
+
+    } else
+    {
+        return -1;
+    }
+
+    memcpy ( &key.port, arr + hdrlen - 2, 2 );
+
+    if ( !( udp->out[out].msg_hdr.msg_namelen = udp_key_addr ( assoc->family, &key,
+                udp->out_addr + out ) ) )
+    {
+        return -1;
+    }
+
+    udp->out_iov[out].iov_base = arr + hdrlen;
+    udp->out_iov[out].iov_len = len - hdrlen;
+    udp_peer_add ( proxy, assoc, &key );
+
+    return 0;
+}
+
+/**
+ * Queue peer datagram to the client, header is built in front of the payload
+ */
+static int udp_from_peer ( struct proxy_t *proxy, struct udp_assoc_t *assoc,
+    const struct udp_key_t *key, uint8_t * arr, size_t len, size_t out )
+{
+    uint8_t *hdr;
+    struct proxy_udp_t *udp = proxy->udp;
+
+    /* Only peers the client sent to may answer */
+    if ( !assoc->client.port || !udp_peer_find ( assoc, key ) )
+    {
+        return -1;
+    }
+
+    if ( IN6_IS_ADDR_V4MAPPED ( ( const struct in6_addr * ) key->addr ) )
+    {
+        hdr = arr - 10;
+        hdr[3] = 1;
+        memcpy ( hdr + 4, key->addr + 12, 4 );
+
+    } else
+    {
+        hdr = arr - 22;
+        hdr[3] = 4;
+        memcpy ( hdr + 4, key->addr, 16 );
+    }
+
+    hdr[0] = 0;
+    hdr[1] = 0;
+    hdr[2] = 0;
+    memcpy ( arr - 2, &key->port, 2 );
+
+    memcpy ( udp->out_addr + out, &assoc->client_addr, sizeof ( assoc->client_addr ) );
+    udp->out[out].msg_hdr.msg_namelen = assoc->family == AF_INET
+        ? sizeof ( struct sockaddr_in ) : sizeof ( struct sockaddr_in6 );
+    udp->out_iov[out].iov_base = hdr;
+    udp->out_iov[out].iov_len = len + ( arr - hdr );
+
+    return 0;
+}
+
+/**
+ * Send queued datagrams, those the socket cannot take are dropped
+ */
+static void udp_flush ( struct proxy_t *proxy, int sock, size_t count )
+{
+    int sent;
+    size_t done = 0;
+    struct proxy_udp_t *udp = proxy->udp;
+
+    while ( done < count )
+    {
+        proxy->stat_udp_calls++;
+
+        if ( ( sent = sendmmsg ( sock, udp->out + done, count - done, 0 ) ) < 0 )
+        {
+            if ( errno == EAGAIN || errno == EWOULDBLOCK )
+            {
+                proxy->stat_udp_dropped += count - done;
+                return;
+            }
+
+            /* Datagram refused by the route is skipped */
+            verbose ( "cannot send datagram on socket:%i (%i)\n", sock, errno );
+            proxy->stat_udp_dropped++;
+            sent = 1;
+
+        } else
+        {
+            proxy->stat_datagrams += sent;
+        }
+
+        done += sent;
+    }
+}
+
+/**
+ * Relay datagrams of the association in batches
+ */
+static int udp_relay ( struct proxy_t *proxy, struct stream_t *stream )
+{
+    int i;
+    int nrecv;
+    int round;
+    size_t out;
+    uint8_t *arr;
+    unsigned long tick;
+    unsigned long long bytes = 0;
+    struct udp_key_t key;
+    struct proxy_udp_t *udp = proxy->udp;
+    struct udp_assoc_t *assoc = udp->assocs[stream->index];
+
+    for ( round = 0; round < UDP_ROUNDS; round++ )
+    {
+        for ( i = 0; i < UDP_BATCH; i++ )
+        {
+            udp->in_iov[i].iov_base = udp->arr[i] + UDP_HEADER_ROOM;
+            udp->in_iov[i].iov_len = UDP_DATAGRAM_MAX;
+            udp->in[i].msg_hdr.msg_name = udp->in_addr + i;
+            udp->in[i].msg_hdr.msg_namelen = sizeof ( struct sockaddr_storage );
+            udp->in[i].msg_hdr.msg_iov = udp->in_iov + i;
+            udp->in[i].msg_hdr.msg_iovlen = 1;
+            udp->in[i].msg_hdr.msg_control = NULL;
+            udp->in[i].msg_hdr.msg_controllen = 0;
+            udp->in[i].msg_hdr.msg_flags = 0;
+        }
+
+        proxy->stat_udp_calls++;
+
+        if ( ( nrecv = recvmmsg ( stream->fd, udp->in, UDP_BATCH, MSG_DONTWAIT, NULL ) ) < 0 )
+        {
+            if ( errno == EAGAIN || errno == EWOULDBLOCK )
+            {
+                stream_clear_ready ( stream, POLLIN );
+                break;
+            }
+            failure ( "cannot receive datagrams (%i) from socket:%i\n", errno, stream->fd );
+            return -1;
+        }
+
+        for ( i = 0, out = 0; i < nrecv; i++ )
+        {
+            arr = udp->arr[i] + UDP_HEADER_ROOM;
+
+            if ( ( udp->in[i].msg_hdr.msg_flags & MSG_TRUNC )
+                || udp_key ( udp->in_addr + i, &key ) < 0 )
+            {
+                proxy->stat_udp_dropped++;
+                continue;
+            }
+
+            udp->out[out].msg_hdr.msg_name = udp->out_addr + out;
+            udp->out[out].msg_hdr.msg_iov = udp->out_iov + out;
+            udp->out[out].msg_hdr.msg_iovlen = 1;
+            udp->out[out].msg_hdr.msg_control = NULL;
+            udp->out[out].msg_hdr.msg_controllen = 0;
+            udp->out[out].msg_hdr.msg_flags = 0;
+
+            /* Client port is learned from its first datagram unless requested */
+            if ( !memcmp ( key.addr, assoc->client.addr, sizeof ( key.addr ) )
+                && ( key.port == assoc->client.port || !assoc->client.port ) )
+            {
+                if ( !assoc->client.port )
+                {
+                    assoc->client.port = key.port;
+                    udp_key_addr ( assoc->family, &assoc->client, &assoc->client_addr );
+                }
+
+                if ( udp_from_client ( proxy, assoc, arr, udp->in[i].msg_len, out ) < 0 )
+                {
+                    proxy->stat_udp_dropped++;
+                    continue;
+                }
+
+            } else if ( udp_from_peer ( proxy, assoc, &key, arr, udp->in[i].msg_len, out ) < 0 )
+            {
+                proxy->stat_udp_dropped++;
+                continue;
+            }
+
+            bytes += udp->out_iov[out].iov_len;
+            out++;
+        }
+
+        udp_flush ( proxy, stream->fd, out );
+
+        /* Short batch drained the socket */
+        if ( nrecv < UDP_BATCH )
+        {
+            stream_clear_ready ( stream, POLLIN );
+            break;
+        }
+    }
+
+    /* Burst left is served on the next cycle */
+    if ( round == UDP_ROUNDS )
+    {
+        stream_set_dirty ( proxy, stream );
+        proxy->stat_deferred++;
+    }
+
+    /* Activity is kept by the association side, relisted once per tick */
+    stream->bytes += bytes;
+    if ( bytes && stream->active != ( tick = proxy->now / TIMER_TICK_MSEC ) )
+    {
+        stream->active = tick;
+        stream_set_list ( proxy, stream, LIST_ESTABLISHED );
+    }
+
+    return 0;
+}
+
+/**
+ * Watch control connection for its end, data sent there is dropped
+ */
+static int udp_control ( struct proxy_t *proxy, struct stream_t *stream )
+{
+    ssize_t len;
+    uint8_t arr[DATA_QUEUE_CAPACITY];
+
+    while ( ( len = recv ( stream->fd, arr, sizeof ( arr ), 0 ) ) > 0 );
+
+    if ( len < 0 && ( errno == EAGAIN || errno == EWOULDBLOCK ) )
+    {
+        stream_clear_ready ( stream, POLLIN );
+        return 0;
+    }
+
+    verbose ( "udp association control socket:%i closed\n", stream->fd );
+
+    return -1;
+}
+
+/**
+ * Handle events of association or its control connection
+ */
+int udp_handle_events ( struct proxy_t *proxy, struct stream_t *stream )
+{
+    if ( !stream->neighbour )
+    {
+        return -1;
+    }
+
+    if ( stream->role == S_PORT_U )
+    {
+        return udp_relay ( proxy, stream );
+    }
+
+    return udp_control ( proxy, stream );
+}
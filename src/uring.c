@@ -0,0 +1,685 @@
+/* ------------------------------------------------------------------
+ * Proxy Util - io_uring Event Backend
+ * ------------------------------------------------------------------ */
+
+#define PROXY_UTIL_BASE_STRUCTS
+#include "util.h"
+
+#if defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#endif
+#endif
+
+#if defined(__NR_io_uring_setup) && defined(IORING_ACCEPT_MULTISHOT)
+
+/**
+ * Request kinds encoded in completion user data
+ */
+#define URING_OP_NONE               0
+#define URING_OP_POLL               1
+#define URING_OP_ACCEPT             2
+
+/**
+ * Multishot accept states
+ */
+#define URING_ACCEPT_RUNNING        0
+#define URING_ACCEPT_CANCELING      1
+#define URING_ACCEPT_PAUSED         2
+
+/**
+ * Accept queue length which pauses multishot accept,
+ * leaves room for completions already posted
+ */
+#define URING_ACCEPT_PAUSE_LEN      (URING_ACCEPT_QUEUE - 2 * URING_ENTRIES)
+
+/**
+ * io_uring instance state
+ */
+struct proxy_uring_t
+{
+    int fd;
+    void *sq_ptr;
+    void *cq_ptr;
+    size_t sq_len;
+    size_t cq_len;
+    size_t sqes_len;
+    unsigned int *sq_head;
+    unsigned int *sq_tail;
+    unsigned int *sq_mask;
+    unsigned int *sq_array;
+    unsigned int *cq_head;
+    unsigned int *cq_tail;
+    unsigned int *cq_mask;
+    unsigned int sq_entries;
+    unsigned int to_submit;
+    struct io_uring_sqe *sqes;
+    struct io_uring_cqe *cqes;
+    struct stream_t *listener;
+    int accept_state;
+    size_t accept_len;
+    size_t accept_head;
+    int accept_queue[URING_ACCEPT_QUEUE];
+};
+
+/**
+ * Encode request user data
+ */
+static uint64_t uring_user_data ( const struct stream_t *stream, int op )
+{
+    return stream_ref ( stream ) | ( ( uint64_t ) op << 24 );
+}
+
+/**
+ * Submit queued requests and optionally wait for completions
+ */
+static int uring_enter ( struct proxy_t *proxy, unsigned int min_complete, int timeout_msec )
+{
+    int status;
+    unsigned int flags = 0;
+    struct __kernel_timespec ts;
+    struct io_uring_getevents_arg arg;
+    struct proxy_uring_t *uring = proxy->uring;
+
+    memset ( &arg, '\0', sizeof ( arg ) );
+
+    if ( min_complete )
+    {
+        ts.tv_sec = timeout_msec / 1000;
+        ts.tv_nsec = ( timeout_msec % 1000 ) * 1000000L;
+        arg.ts = ( uint64_t ) ( uintptr_t ) & ts;
+        flags = IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG;
+    }
+
+    proxy->stat_uring_enter++;
+
+    if ( ( status = syscall ( __NR_io_uring_enter, uring->fd, uring->to_submit, min_complete,
+                flags, flags ? &arg : NULL, flags ? sizeof ( arg ) : 0 ) ) < 0 )
+    {
+        return errno == ETIME ? 0 : -1;
+    }
+
+    uring->to_submit -= status;
+
+    return 0;
+}
+
+/**
+ * Get next free submission queue entry
+ */
+static struct io_uring_sqe *uring_get_sqe ( struct proxy_t *proxy )
+{
+    unsigned int tail;
+    unsigned int index;
+    struct io_uring_sqe *sqe;
+    struct proxy_uring_t *uring = proxy->uring;
+
+    /* Flush the queue when full */
+    if ( uring->to_submit >= uring->sq_entries && uring_enter ( proxy, 0, 0 ) < 0 )
+    {
+        failure ( "cannot submit io_uring requests (%i)\n", errno );
+        return NULL;
+    }
+
+    tail = *uring->sq_tail;
+    index = tail & *uring->sq_mask;
+    sqe = uring->sqes + index;
+    memset ( sqe, '\0', sizeof ( struct io_uring_sqe ) );
+    uring->sq_array[index] = index;
+    __atomic_store_n ( uring->sq_tail, tail + 1, __ATOMIC_RELEASE );
+    uring->to_submit++;
+
+    return sqe;
+}
+
+/**
+ * Check if any request kind is not supported by the kernel
+ */
+static int uring_probe_ops ( struct proxy_t *proxy )
+{
+    size_t i;
+    size_t len;
+    int status = 0;
+    struct io_uring_probe *probe;
+    static const int ops[] = {
+        IORING_OP_POLL_ADD, IORING_OP_POLL_REMOVE, IORING_OP_ACCEPT,
+        IORING_OP_SHUTDOWN, IORING_OP_CLOSE, IORING_OP_ASYNC_CANCEL,
+        /* Multishot accept arrived together with this opcode */
+        IORING_OP_SOCKET
+    };
+
+    len = sizeof ( struct io_uring_probe ) + 256 * sizeof ( struct io_uring_probe_op );
+
+    if ( !( probe = ( struct io_uring_probe * ) calloc ( 1, len ) ) )
+    {
+        return -1;
+    }
+
+    if ( syscall ( __NR_io_uring_register, ( ( struct proxy_uring_t * ) proxy->uring )->fd,
+            IORING_REGISTER_PROBE, probe, 256 ) < 0 )
+    {
+        free ( probe );
+        return -1;
+    }
+
+    for ( i = 0; i < sizeof ( ops ) / sizeof ( int ); i++ )
+    {
+        if ( ops[i] > probe->last_op || !( probe->ops[ops[i]].flags & IO_URING_OP_SUPPORTED ) )
+        {
+            verbose ( "io_uring opcode %i not supported\n", ops[i] );
+            status = -1;
+        }
+    }
+
+    free ( probe );
+
+    return status;
+}
+
+/**
+ * Setup io_uring instance
+ */
+int uring_setup ( struct proxy_t *proxy )
+{
+    struct io_uring_params params;
+    struct proxy_uring_t *uring;
+
+    if ( !( uring = ( struct proxy_uring_t * ) calloc ( 1, sizeof ( struct proxy_uring_t ) ) ) )
+    {
+        return -1;
+    }
+
+    memset ( &params, '\0', sizeof ( params ) );
+    params.flags = IORING_SETUP_CQSIZE;
+    params.cq_entries = URING_ENTRIES * 4;
+
+    if ( ( uring->fd = syscall ( __NR_io_uring_setup, URING_ENTRIES, &params ) ) < 0 )
+    {
+        verbose ( "io_uring setup failed (%i)\n", errno );
+        free ( uring );
+        return -1;
+    }
+
+    proxy->uring = uring;
+
+    if ( ~params.features & IORING_FEAT_EXT_ARG || uring_probe_ops ( proxy ) < 0 )
+    {
+        verbose ( "io_uring features are not sufficient\n" );
+        uring_free ( proxy );
+        return -1;
+    }
+
+    /* Map rings */
+    uring->sq_len = params.sq_off.array + params.sq_entries * sizeof ( unsigned int );
+    uring->cq_len = params.cq_off.cqes + params.cq_entries * sizeof ( struct io_uring_cqe );
+
+    if ( params.features & IORING_FEAT_SINGLE_MMAP )
+    {
+        if ( uring->cq_len > uring->sq_len )
+        {
+            uring->sq_len = uring->cq_len;
+        }
+        uring->cq_len = 0;
+    }
+
+    if ( ( uring->sq_ptr = mmap ( NULL, uring->sq_len, PROT_READ | PROT_WRITE,
+                MAP_SHARED | MAP_POPULATE, uring->fd, IORING_OFF_SQ_RING ) ) == MAP_FAILED )
+    {
+        uring->sq_ptr = NULL;
+        uring_free ( proxy );
+        return -1;
+    }
+
+    if ( !uring->cq_len )
+    {
+        uring->cq_ptr = uring->sq_ptr;
+
+    } else if ( ( uring->cq_ptr = mmap ( NULL, uring->cq_len, PROT_READ | PROT_WRITE,
+                MAP_SHARED | MAP_POPULATE, uring->fd, IORING_OFF_CQ_RING ) ) == MAP_FAILED )
+    {
+        uring->cq_ptr = NULL;
+        uring_free ( proxy );
+        return -1;
+    }
+
+    uring->sqes_len = params.sq_entries * sizeof ( struct io_uring_sqe );
+
+    if ( ( uring->sqes = mmap ( NULL, uring->sqes_len, PROT_READ | PROT_WRITE,
+                MAP_SHARED | MAP_POPULATE, uring->fd, IORING_OFF_SQES ) ) == MAP_FAILED )
+    {
+        uring->sqes = NULL;
+        uring_free ( proxy );
+        return -1;
+    }
+
+    uring->sq_head = ( unsigned int * ) ( ( uint8_t * ) uring->sq_ptr + params.sq_off.head );
+    uring->sq_tail = ( unsigned int * ) ( ( uint8_t * ) uring->sq_ptr + params.sq_off.tail );
+    uring->sq_mask = ( unsigned int * ) ( ( uint8_t * ) uring->sq_ptr + params.sq_off.ring_mask );
+    uring->sq_array = ( unsigned int * ) ( ( uint8_t * ) uring->sq_ptr + params.sq_off.array );
+    uring->cq_head = ( unsigned int * ) ( ( uint8_t * ) uring->cq_ptr + params.cq_off.head );
+    uring->cq_tail = ( unsigned int * ) ( ( uint8_t * ) uring->cq_ptr + params.cq_off.tail );
+    uring->cq_mask = ( unsigned int * ) ( ( uint8_t * ) uring->cq_ptr + params.cq_off.ring_mask );
+    uring->cqes = ( struct io_uring_cqe * ) ( ( uint8_t * ) uring->cq_ptr + params.cq_off.cqes );
+    uring->sq_entries = params.sq_entries;
+
+    verbose ( "io_uring initialized with %u entries\n", params.sq_entries );
+
+    return 0;
+}
+
+/**
+ * Release io_uring instance
+ */
+void uring_free ( struct proxy_t *proxy )
+{
+    struct proxy_uring_t *uring = proxy->uring;
+
+    if ( !uring )
+    {
+        return;
+    }
+
+    /* Run requests still queued, mostly socket closes */
+    if ( uring->to_submit && uring->sqes )
+    {
+        uring_enter ( proxy, 0, 0 );
+    }
+
+    while ( uring->accept_len )
+    {
+        close ( uring->accept_queue[uring->accept_head] );
+        uring->accept_head = ( uring->accept_head + 1 ) % URING_ACCEPT_QUEUE;
+        uring->accept_len--;
+    }
+
+    if ( uring->sqes )
+    {
+        munmap ( uring->sqes, uring->sqes_len );
+    }
+
+    if ( uring->cq_ptr && uring->cq_ptr != uring->sq_ptr )
+    {
+        munmap ( uring->cq_ptr, uring->cq_len );
+    }
+
+    if ( uring->sq_ptr )
+    {
+        munmap ( uring->sq_ptr, uring->sq_len );
+    }
+
+    close ( uring->fd );
+    free ( uring );
+    proxy->uring = NULL;
+}
+
+/**
+ * Queue multishot readiness or accept request for a stream
+ */
+static int uring_arm_stream ( struct proxy_t *proxy, struct stream_t *stream )
+{
+    unsigned int mask;
+    struct io_uring_sqe *sqe;
+    struct proxy_uring_t *uring = proxy->uring;
+
+    if ( !( sqe = uring_get_sqe ( proxy ) ) )
+    {
+        return -1;
+    }
+
+    sqe->fd = stream->fd;
+
+    /* Listener is told by its role, no need to ask the kernel */
+    if ( stream->role == L_ACCEPT )
+    {
+        sqe->opcode = IORING_OP_ACCEPT;
+        sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+        sqe->accept_flags = SOCK_NONBLOCK | SOCK_CLOEXEC;
+        sqe->user_data = uring_user_data ( stream, URING_OP_ACCEPT );
+        uring->listener = stream;
+        uring->accept_state = URING_ACCEPT_RUNNING;
+        verbose ( "io_uring multishot accept queued on socket:%i\n", stream->fd );
+
+    } else
+    {
+        mask = POLLIN | POLLOUT | POLLRDHUP | POLLERR | POLLHUP;
+#if __BYTE_ORDER == __BIG_ENDIAN
+        mask = ( mask << 16 ) | ( mask >> 16 );
+#endif
+        sqe->opcode = IORING_OP_POLL_ADD;
+        sqe->len = IORING_POLL_ADD_MULTI;
+        sqe->poll32_events = mask;
+        sqe->user_data = uring_user_data ( stream, URING_OP_POLL );
+        verbose ( "io_uring multishot poll queued on socket:%i\n", stream->fd );
+    }
+
+    stream->pollref = EPOLLREF;
+
+    return 0;
+}
+
+/**
+ * Cancel stream requests, then shutdown and close its socket
+ */
+int uring_remove_stream ( struct proxy_t *proxy, struct stream_t *stream )
+{
+    struct io_uring_sqe *sqe;
+    struct proxy_uring_t *uring = proxy->uring;
+
+    /* Cancel pending poll or accept, it holds the socket */
+    if ( !( sqe = uring_get_sqe ( proxy ) ) )
+    {
+        return -1;
+    }
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->addr = uring_user_data ( stream,
+        stream == uring->listener ? URING_OP_ACCEPT : URING_OP_POLL );
+
+    if ( stream == uring->listener )
+    {
+        uring->listener = NULL;
+    }
+    sqe->flags = IOSQE_IO_HARDLINK;
+    sqe->user_data = URING_OP_NONE;
+
+    if ( !( sqe = uring_get_sqe ( proxy ) ) )
+    {
+        return -1;
+    }
+    sqe->opcode = IORING_OP_SHUTDOWN;
+    sqe->fd = stream->fd;
+    sqe->len = SHUT_RDWR;
+    sqe->flags = IOSQE_IO_HARDLINK;
+    sqe->user_data = URING_OP_NONE;
+
+    if ( !( sqe = uring_get_sqe ( proxy ) ) )
+    {
+        return -1;
+    }
+    sqe->opcode = IORING_OP_CLOSE;
+    sqe->fd = stream->fd;
+    sqe->user_data = URING_OP_NONE;
+
+    verbose ( "socket:%i close queued\n", stream->fd );
+
+    return 0;
+}
+
+/**
+ * Stop multishot accept until accepted sockets are taken
+ */
+static void uring_pause_accept ( struct proxy_t *proxy, struct stream_t *stream )
+{
+    struct io_uring_sqe *sqe;
+    struct proxy_uring_t *uring = proxy->uring;
+
+    if ( !( sqe = uring_get_sqe ( proxy ) ) )
+    {
+        return;
+    }
+
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->addr = uring_user_data ( stream, URING_OP_ACCEPT );
+    sqe->user_data = URING_OP_NONE;
+    uring->accept_state = URING_ACCEPT_CANCELING;
+
+    verbose ( "io_uring accept paused on socket:%i\n", stream->fd );
+}
+
+/**
+ * Take a socket accepted by multishot accept
+ */
+int uring_accept ( struct proxy_t *proxy )
+{
+    int sock;
+    struct proxy_uring_t *uring = proxy->uring;
+
+    if ( !uring->accept_len )
+    {
+        errno = EAGAIN;
+        return -1;
+    }
+
+    sock = uring->accept_queue[uring->accept_head];
+    uring->accept_head = ( uring->accept_head + 1 ) % URING_ACCEPT_QUEUE;
+    uring->accept_len--;
+
+    return sock;
+}
+
+/**
+ * Push stream onto ready list if any event is due
+ */
+static void uring_update_ready ( struct proxy_t *proxy, struct stream_t *stream )
+{
+    short revents;
+
+    if ( stream == ( ( struct proxy_uring_t * ) proxy->uring )->listener )
+    {
+        revents = ( ( struct proxy_uring_t * ) proxy->uring )->accept_len ? POLLIN : 0;
+
+    } else
+    {
+        revents = stream->readiness;
+    }
+
+    revents &= stream->events | POLLERR | POLLHUP;
+
+    if ( revents && !stream->revents && proxy->ready_len < proxy->stream_limit )
+    {
+        stream_set_ready ( proxy, stream );
+    }
+
+    stream->revents = revents;
+}
+
+/**
+ * Handle a single completion
+ */
+static void uring_handle_cqe ( struct proxy_t *proxy, const struct io_uring_cqe *cqe )
+{
+    struct stream_t *stream;
+    struct proxy_uring_t *uring = proxy->uring;
+
+    if ( ( cqe->user_data >> 24 & 0xff ) == URING_OP_NONE )
+    {
+        return;
+    }
+
+    if ( !( stream = stream_lookup ( proxy, cqe->user_data ) ) )
+    {
+        /* Socket accepted for a listener already gone */
+        if ( ( cqe->user_data >> 24 & 0xff ) == URING_OP_ACCEPT && cqe->res >= 0 )
+        {
+            close ( cqe->res );
+        }
+        return;
+    }
+
+    if ( cqe->res >= 0 )
+    {
+        if ( ( cqe->user_data >> 24 & 0xff ) == URING_OP_ACCEPT )
+        {
+            if ( uring->accept_len < URING_ACCEPT_QUEUE )
+            {
+                uring->accept_queue[( uring->accept_head +
+                        uring->accept_len ) % URING_ACCEPT_QUEUE] = cqe->res;
+                uring->accept_len++;
+
+                /* Leave further connections in the listen backlog */
+                if ( uring->accept_len >= URING_ACCEPT_PAUSE_LEN
+                    && uring->accept_state == URING_ACCEPT_RUNNING )
+                {
+                    uring_pause_accept ( proxy, stream );
+                }
+
+            } else
+            {
+                failure ( "io_uring accept queue is full\n" );
+                close ( cqe->res );
+            }
+
+        } else
+        {
+            stream->readiness |= cqe->res & ( POLLIN | POLLOUT | POLLERR | POLLHUP );
+            if ( cqe->res & POLLRDHUP )
+            {
+                stream->readiness |= POLLIN | POLLRDHUP;
+            }
+        }
+
+        uring_update_ready ( proxy, stream );
+
+    } else if ( cqe->res != -ECANCELED )
+    {
+        failure ( "io_uring request failed (%i) on socket:%i\n", -cqe->res, stream->fd );
+    }
+
+    /* Paused accept is queued again once drained */
+    if ( ~cqe->flags & IORING_CQE_F_MORE && stream == uring->listener
+        && uring->accept_state != URING_ACCEPT_RUNNING )
+    {
+        uring->accept_state = URING_ACCEPT_PAUSED;
+        return;
+    }
+
+    /* Multishot request ended, queue it again */
+    if ( ~cqe->flags & IORING_CQE_F_MORE && !stream->abandoned && stream->fd >= 0 )
+    {
+        verbose ( "io_uring request ended on socket:%i, rearming...\n", stream->fd );
+        uring_arm_stream ( proxy, stream );
+    }
+}
+
+/**
+ * Watch stream events with io_uring
+ */
+int watch_streams_uring ( struct proxy_t *proxy )
+{
+    int count = 0;
+    size_t pending;
+    unsigned int head;
+    unsigned int tail;
+    struct stream_t *iter;
+    struct proxy_uring_t *uring = proxy->uring;
+
+    /* Queue requests for new streams only */
+    while ( ( iter = stream_pop_dirty ( proxy ) ) )
+    {
+        if ( iter->abandoned )
+        {
+            continue;
+        }
+
+        if ( iter->events && !iter->pollref && uring_arm_stream ( proxy, iter ) < 0 )
+        {
+            return -1;
+        }
+
+        /* Dispatch at once if already known to be ready */
+        uring_update_ready ( proxy, iter );
+    }
+
+    /* Accepted sockets still queued */
+    if ( uring->listener )
+    {
+        if ( uring->accept_state == URING_ACCEPT_PAUSED && uring->accept_len < ACCEPT_BATCH
+            && uring_arm_stream ( proxy, uring->listener ) < 0 )
+        {
+            return -1;
+        }
+        uring_update_ready ( proxy, uring->listener );
+    }
+
+    pending = proxy->ready_len;
+    head = *uring->cq_head;
+    tail = __atomic_load_n ( uring->cq_tail, __ATOMIC_ACQUIRE );
+
+    /* Submit requests, wait only if nothing is ready */
+    if ( uring->to_submit || ( !pending && head == tail ) )
+    {
+        if ( uring_enter ( proxy, !pending && head == tail,
+                timer_wait_msec ( proxy ) ) < 0 )
+        {
+            if ( errno != EINTR )
+            {
+                failure ( "io_uring enter failed (%i)\n", errno );
+                return -1;
+            }
+            if ( !pending )
+            {
+                return -1;
+            }
+        }
+        tail = __atomic_load_n ( uring->cq_tail, __ATOMIC_ACQUIRE );
+    }
+
+    /* Reap completions */
+    for ( ; head != tail; head++ )
+    {
+        uring_handle_cqe ( proxy, uring->cqes + ( head & *uring->cq_mask ) );
+        count++;
+    }
+
+    __atomic_store_n ( uring->cq_head, head, __ATOMIC_RELEASE );
+
+    if ( count )
+    {
+        verbose ( "found %i completion%s with io_uring\n", count, count == 1 ? "" : "s" );
+    }
+
+    return count + pending;
+}
+
+#else
+
+/**
+ * Setup io_uring instance
+ */
+int uring_setup ( struct proxy_t *proxy )
+{
+    UNUSED ( proxy );
+    verbose ( "io_uring not supported by build\n" );
+    return -1;
+}
+
+/**
+ * Release io_uring instance
+ */
+void uring_free ( struct proxy_t *proxy )
+{
+    UNUSED ( proxy );
+}
+
+/**
+ * Cancel stream requests, then shutdown and close its socket
+ */
+int uring_remove_stream ( struct proxy_t *proxy, struct stream_t *stream )
+{
+    UNUSED ( proxy );
+    UNUSED ( stream );
+    return -1;
+}
+
+/**
+ * Take a socket accepted by multishot accept
+ */
+int uring_accept ( struct proxy_t *proxy )
+{
+    UNUSED ( proxy );
+    errno = ENOSYS;
+    return -1;
+}
+
+/**
+ * Watch stream events with io_uring
+ */
+int watch_streams_uring ( struct proxy_t *proxy )
+{
+    UNUSED ( proxy );
+    errno = ENOSYS;
+    return -1;
+}
+
+#endif
@@ -184,11 +184,15 @@ void format_ip_port ( const struct sockaddr_storage *saddr, char *buffer, size_t
 /* NOTE: Socket Related Functions */
 
 /**
- * Connect remote endpoint asynchronously
+ * Connect remote endpoint asynchronously, sending early data
+ * with the SYN where allowed, the length is updated to bytes sent
  */
-int connect_async ( struct proxy_t *proxy, const struct sockaddr_storage *saddr )
+int connect_async ( struct proxy_t *proxy, const struct sockaddr_storage *saddr,
+    const uint8_t * data, size_t *len )
 {
     int sock;
+    int index;
+    ssize_t sent = 0;
 
     /* Create new socket */
     if ( ( sock = socket ( saddr->ss_family, SOCK_STREAM, 0 ) ) < 0 )
@@ -204,8 +208,38 @@ int connect_async ( struct proxy_t *proxy, const struct sockaddr_storage *saddr
         return -1;
     }
 
-    /* Asynchronous connect endpoint */
-    if ( connect ( sock, ( const struct sockaddr * ) saddr,
+    socket_set_busy_poll ( proxy, sock );
+
+    /* Buffer sizes must be known before the handshake scales the window */
+    if ( proxy->profile_count && ( index = profile_match ( proxy, saddr ) ) >= 0 )
+    {
+        profile_apply ( proxy, index, sock );
+    }
+
+#ifdef MSG_FASTOPEN
+    /* Without a cookie yet nothing is sent but the SYN asks for one */
+    if ( proxy->fast_open && *len )
+    {
+        sent = sendto ( sock, data, *len, MSG_FASTOPEN, ( const struct sockaddr * ) saddr,
+            sizeof ( struct sockaddr_storage ) );
+    }
+#endif
+
+    *len = sent > 0 ? ( size_t ) sent : 0;
+
+    /* Asynchronous connect endpoint, unless fast open started it */
+    if ( sent > 0 )
+    {
+        verbose ( "sent %lu early byte(s) with syn on socket:%i\n", ( unsigned long ) sent,
+            sock );
+        proxy->stat_fastopen++;
+        proxy->stat_early += sent;
+
+    } else if ( sent < 0 && errno == EINPROGRESS )
+    {
+        verbose ( "fast open cookie requested on socket:%i\n", sock );
+
+    } else if ( connect ( sock, ( const struct sockaddr * ) saddr,
             sizeof ( struct sockaddr_storage ) ) >= 0 )
     {
         failure ( "cannot async-connect endpoint (%i) with socket:%i\n", errno, sock );
@@ -214,7 +248,7 @@ int connect_async ( struct proxy_t *proxy, const struct sockaddr_storage *saddr
     }
 
     /* Connecting should be in progress */
-    if ( errno != EINPROGRESS )
+    if ( sent <= 0 && errno != EINPROGRESS )
     {
         failure ( "failed to async-connect endpoint (%i) with socket:%i\n", errno, sock );
         shutdown_then_close ( proxy, sock );
@@ -242,8 +276,9 @@ int listen_socket ( struct proxy_t *proxy, const struct sockaddr_storage *saddr
     int sock;
     int yes = 1;
 
-    /* Allocate socket */
-    if ( ( sock = socket ( saddr->ss_family, SOCK_STREAM, 0 ) ) < 0 )
+    /* Allocate socket, non-blocking to drain accepts in batches */
+    if ( ( sock = socket ( saddr->ss_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC,
+                0 ) ) < 0 )
     {
         failure ( "cannot create listen socket (%i)\n", errno );
         return -1;
@@ -261,6 +296,21 @@ int listen_socket ( struct proxy_t *proxy, const struct sockaddr_storage *saddr
 
     verbose ( "done setting reuse address on socket:%i\n", sock );
 
+#ifdef SO_REUSEPORT
+    /* Let worker loops share the listen port */
+    if ( proxy->workers )
+    {
+        if ( setsockopt ( sock, SOL_SOCKET, SO_REUSEPORT, &yes, sizeof ( yes ) ) < 0 )
+        {
+            failure ( "cannot reuse port (%i) on socket:%i\n", errno, sock );
+            shutdown_then_close ( proxy, sock );
+            return -1;
+        }
+
+        verbose ( "done setting reuse port on socket:%i\n", sock );
+    }
+#endif
+
     /* Bind socket to address */
     if ( bind ( sock, ( const struct sockaddr * ) saddr, sizeof ( struct sockaddr_storage ) ) < 0 )
     {
@@ -271,8 +321,40 @@ int listen_socket ( struct proxy_t *proxy, const struct sockaddr_storage *saddr
 
     verbose ( "bound socket:%i to network address\n", sock );
 
+#ifdef TCP_DEFER_ACCEPT
+    /* Wake up only once the client has sent data */
+    if ( proxy->defer_accept )
+    {
+        if ( setsockopt ( sock, IPPROTO_TCP, TCP_DEFER_ACCEPT, &proxy->defer_accept,
+                sizeof ( proxy->defer_accept ) ) < 0 )
+        {
+            failure ( "cannot defer accept (%i) on socket:%i\n", errno, sock );
+            shutdown_then_close ( proxy, sock );
+            return -1;
+        }
+
+        verbose ( "done setting defer accept on socket:%i\n", sock );
+    }
+#endif
+
+#ifdef TCP_FASTOPEN
+    /* Accept data carried by the SYN of clients holding a cookie */
+    if ( proxy->fast_open )
+    {
+        yes = FAST_OPEN_QUEUE;
+        if ( setsockopt ( sock, IPPROTO_TCP, TCP_FASTOPEN, &yes, sizeof ( yes ) ) < 0 )
+        {
+            verbose ( "cannot enable fast open (%i) on socket:%i\n", errno, sock );
+
+        } else
+        {
+            verbose ( "done setting fast open on socket:%i\n", sock );
+        }
+    }
+#endif
+
     /* Put socket into listen mode */
-    if ( listen ( sock, LISTEN_BACKLOG ) < 0 )
+    if ( listen ( sock, proxy->listen_backlog ? proxy->listen_backlog : LISTEN_BACKLOG ) < 0 )
     {
         failure ( "cannot put socket:%i in listen mode (%i)\n", sock, errno );
         shutdown_then_close ( proxy, sock );
@@ -284,6 +366,56 @@ int listen_socket ( struct proxy_t *proxy, const struct sockaddr_storage *saddr
     return sock;
 }
 
+/**
+ * Steer listen socket group connections by incoming CPU
+ */
+int listen_socket_steer_cpu ( struct proxy_t *proxy, int sock, const int *cpus, int groups )
+{
+#ifdef SO_ATTACH_REUSEPORT_CBPF
+    int i;
+    unsigned short len = 0;
+    struct sock_filter code[2 * WORKERS_LIMIT + 3];
+    struct sock_fprog prog;
+
+    UNUSED ( proxy );
+
+    /* A = CPU which received the packet */
+    code[len++] = ( struct sock_filter ) { BPF_LD | BPF_W | BPF_ABS, 0, 0,
+        SKF_AD_OFF + SKF_AD_CPU };
+
+    /* Select listen socket of the worker pinned to that CPU */
+    for ( i = 0; i < groups; i++ )
+    {
+        code[len++] = ( struct sock_filter ) { BPF_JMP | BPF_JEQ | BPF_K, 0, 1, cpus[i] };
+        code[len++] = ( struct sock_filter ) { BPF_RET | BPF_K, 0, 0, i };
+    }
+
+    /* Other CPUs are spread by A % listen sockets count */
+    code[len++] = ( struct sock_filter ) { BPF_ALU | BPF_MOD | BPF_K, 0, 0, groups };
+    code[len++] = ( struct sock_filter ) { BPF_RET | BPF_A, 0, 0, 0 };
+
+    prog.len = len;
+    prog.filter = code;
+
+    if ( setsockopt ( sock, SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF, &prog, sizeof ( prog ) ) < 0 )
+    {
+        failure ( "cannot attach cpu steering program (%i) on socket:%i\n", errno, sock );
+        return -1;
+    }
+
+    verbose ( "attached cpu steering program on socket:%i\n", sock );
+
+    return 0;
+#else
+    UNUSED ( proxy );
+    UNUSED ( sock );
+    UNUSED ( cpus );
+    UNUSED ( groups );
+    failure ( "cpu steering is not supported\n" );
+    return -1;
+#endif
+}
+
 /**
  * Check for socket error
  */
@@ -332,126 +464,259 @@ int socket_set_nonblocking ( struct proxy_t *proxy, int sock )
 }
 
 /**
- * Forward data between sockets
+ * Let socket reads busy poll the device queue
  */
-int socket_forward_data ( struct proxy_t *proxy, int srcfd, int dstfd )
+void socket_set_busy_poll ( struct proxy_t *proxy, int sock )
 {
-    int len = FORWARD_CHUNK_LEN;
-    int recvlim;
-    int sendlim;
-    int sendwip;
-    socklen_t optlen;
-    uint8_t buffer[FORWARD_CHUNK_LEN];
+    int value;
 
-    UNUSED ( proxy );
+    if ( !proxy->busy_poll )
+    {
+        return;
+    }
 
-    if ( ioctl ( srcfd, FIONREAD, &recvlim ) < 0 )
+#ifdef SO_BUSY_POLL
+    /* Raising the time above net.core.busy_read needs CAP_NET_ADMIN */
+    value = proxy->busy_poll;
+    if ( setsockopt ( sock, SOL_SOCKET, SO_BUSY_POLL, &value, sizeof ( value ) ) < 0 )
     {
-        failure ( "cannot get socket:%i available bytes count (%i)\n", srcfd, errno );
-        return -1;
+        verbose ( "cannot set socket:%i busy poll (%i)\n", sock, errno );
     }
+#endif
 
-    if ( !recvlim )
+#ifdef SO_PREFER_BUSY_POLL
+    value = 1;
+    if ( setsockopt ( sock, SOL_SOCKET, SO_PREFER_BUSY_POLL, &value, sizeof ( value ) ) < 0 )
     {
-        verbose ( "lost connection on socket:%i\n", srcfd );
-        return -1;
+        verbose ( "cannot set socket:%i prefer busy poll (%i)\n", sock, errno );
     }
+#else
+    UNUSED ( value );
+#endif
+}
+
+/**
+ * Shutdown and close the socket
+ */
+void shutdown_then_close ( struct proxy_t *proxy, int sock )
+{
+    UNUSED(proxy);
+
+    shutdown ( sock, SHUT_RDWR );
+    verbose ( "socket:%i has been shutdown\n", sock );
+    close ( sock );
+    verbose ( "socket:%i has been closed\n", sock );
+}
+
+/* NOTE: Splice Pipe Related Functions */
 
-    verbose ( "socket:%i available bytes count: %i\n", srcfd, recvlim );
+/**
+ * Take splice pipe for the stream data
+ */
+struct pipe_t *pipe_acquire ( struct proxy_t *proxy, struct stream_t *stream )
+{
+    int size;
+    struct pipe_t *pipe;
 
-    if ( recvlim < len )
+    if ( ( pipe = proxy->pipes[stream->index] ) )
     {
-        len = recvlim;
-        verbose ( "bytes count limited to buffer size: %i\n", len );
+        return pipe;
     }
 
-    if ( ioctl ( dstfd, TIOCOUTQ, &sendwip ) < 0 )
+    if ( ( pipe = proxy->pipe_free ) )
     {
-        failure ( "cannot get socket:%i pending bytes count (%i)\n", dstfd, errno );
-        return -1;
+        proxy->pipe_free = pipe->next;
+        proxy->pipe_idle--;
+
+    } else
+    {
+        if ( !( pipe = ( struct pipe_t * ) malloc ( sizeof ( struct pipe_t ) ) ) )
+        {
+            failure ( "cannot allocate splice pipe (%i)\n", errno );
+            return NULL;
+        }
+
+        if ( pipe2 ( pipe->fd, O_NONBLOCK | O_CLOEXEC ) < 0 )
+        {
+            verbose ( "cannot create splice pipe (%i)\n", errno );
+            free ( pipe );
+            return NULL;
+        }
+
+        /* Larger pipe moves more per splice, kernel may cap it */
+        if ( ( size = fcntl ( pipe->fd[1], F_SETPIPE_SZ, SPLICE_PIPE_LEN ) ) < 0
+            && ( size = fcntl ( pipe->fd[1], F_GETPIPE_SZ ) ) < 0 )
+        {
+            size = getpagesize (  );
+        }
+        pipe->size = size;
     }
 
-    verbose ( "socket:%i pending bytes count: %i\n", dstfd, sendwip );
+    pipe->next = NULL;
+    pipe->len = 0;
+    proxy->pipes[stream->index] = pipe;
+
+    return pipe;
+}
+
+/**
+ * Close splice pipe
+ */
+static void pipe_destroy ( struct pipe_t *pipe )
+{
+    close ( pipe->fd[0] );
+    close ( pipe->fd[1] );
+    free ( pipe );
+}
 
-    optlen = sizeof ( sendlim );
+/**
+ * Return drained splice pipe to the pool
+ */
+void pipe_release ( struct proxy_t *proxy, struct stream_t *stream )
+{
+    struct pipe_t *pipe;
 
-    if ( getsockopt ( dstfd, SOL_SOCKET, SO_SNDBUF, &sendlim, &optlen ) < 0 )
+    if ( !proxy->pipes || !( pipe = proxy->pipes[stream->index] ) )
     {
-        failure ( "cannot get socket:%i output capacity (%i)\n", dstfd, errno );
-        return -1;
+        return;
     }
 
-    if ( optlen != sizeof ( sendlim ) )
+    proxy->pipes[stream->index] = NULL;
+
+    /* Pipe still holding data cannot be reused, keep only a few idle pipes */
+    if ( pipe->len || proxy->pipe_idle >= SPLICE_PIPE_IDLE_LIMIT )
     {
-        failure ( "socket:%i output capacity data type is invalid\n", dstfd );
-        return -1;
+        pipe_destroy ( pipe );
+        return;
     }
 
-    verbose ( "socket:%i output capacity: %i\n", dstfd, sendlim );
+    pipe->next = proxy->pipe_free;
+    proxy->pipe_free = pipe;
+    proxy->pipe_idle++;
+}
+
+/* NOTE: Relay Chunk Related Functions */
+
+/**
+ * Take relay chunk for the stream backlog
+ */
+struct chunk_t *chunk_acquire ( struct proxy_t *proxy, struct stream_t *stream )
+{
+    size_t size;
+    struct chunk_t *chunk;
 
-    if ( sendwip > sendlim )
+    if ( ( chunk = proxy->chunks[stream->index] ) )
     {
-        failure ( "socket:%i capacity is less than data pending\n", dstfd );
-        return -1;
+        return chunk;
     }
 
-    sendlim -= sendwip;
+    /* Only chunks of default size are pooled */
+    size = stream->relay_len > FORWARD_CHUNK_LEN ? stream->relay_len : FORWARD_CHUNK_LEN;
 
-    if ( !sendlim )
+    if ( size == FORWARD_CHUNK_LEN && ( chunk = proxy->chunk_free ) )
     {
-        failure ( "socket:%i was expected to be write ready\n", dstfd );
-        return -1;
-    }
+        proxy->chunk_free = chunk->next;
+        proxy->chunk_idle--;
 
-    if ( sendlim < len )
+    } else if ( !( chunk = ( struct chunk_t * ) malloc ( sizeof ( struct chunk_t ) + size ) ) )
     {
-        len = sendlim;
-        verbose ( "bytes count limited to socket:%i output capacity: %i\n", dstfd, len );
+        failure ( "cannot allocate relay chunk (%i)\n", errno );
+        return NULL;
     }
 
-    if ( !len )
+    chunk->next = NULL;
+    chunk->size = size;
+    chunk->off = 0;
+    chunk->len = 0;
+    chunk->eof = 0;
+    proxy->chunks[stream->index] = chunk;
+
+    return chunk;
+}
+
+/**
+ * Return relay chunk to the pool
+ */
+void chunk_release ( struct proxy_t *proxy, struct stream_t *stream )
+{
+    struct chunk_t *chunk;
+
+    if ( !proxy->chunks || !( chunk = proxy->chunks[stream->index] ) )
     {
-        verbose ( "socket:%i no data to be transfered into\n", dstfd );
-        return -1;
+        return;
     }
 
-    if ( recv ( srcfd, buffer, len, MSG_PEEK ) < len )
+    proxy->chunks[stream->index] = NULL;
+
+    /* Keep only a few idle chunks around */
+    if ( chunk->size != FORWARD_CHUNK_LEN || proxy->chunk_idle >= FORWARD_CHUNK_IDLE_LIMIT )
     {
-        failure ( "cannot receive data from socket:%i\n", srcfd );
-        return -1;
+        free ( chunk );
+        return;
     }
 
-    if ( ( len = send ( dstfd, buffer, len, MSG_NOSIGNAL ) ) < 0 )
+    chunk->next = proxy->chunk_free;
+    proxy->chunk_free = chunk;
+    proxy->chunk_idle++;
+}
+
+/* NOTE: Data Queue Related Functions */
+
+/**
+ * Take data queue for the stream handshake
+ */
+struct queue_t *queue_acquire ( struct proxy_t *proxy, struct stream_t *stream )
+{
+    struct queue_t *queue;
+
+    if ( stream->queue )
     {
-        failure ( "cannot send data to socket:%i\n", dstfd );
-        return -1;
+        return stream->queue;
     }
 
-    if ( recv ( srcfd, buffer, len, 0 ) < len )
+    if ( ( queue = proxy->queue_free ) )
     {
-        failure ( "cannot skip data from socket:%i\n", srcfd );
-        return -1;
+        proxy->queue_free = queue->next;
+        proxy->queue_idle--;
+
+    } else if ( !( queue = ( struct queue_t * ) malloc ( sizeof ( struct queue_t ) ) ) )
+    {
+        failure ( "cannot allocate data queue (%i)\n", errno );
+        return NULL;
     }
 
-    verbose ( "forwarded %i byte(s) from socket:%i to socket:%i\n", len, srcfd, dstfd );
+    queue->next = NULL;
+    queue->len = 0;
+    stream->queue = queue;
 
-    return len;
+    return queue;
 }
 
 /**
- * Shutdown and close the socket
+ * Return stream data queue to the pool
  */
-void shutdown_then_close ( struct proxy_t *proxy, int sock )
+void queue_release ( struct proxy_t *proxy, struct stream_t *stream )
 {
-    UNUSED(proxy);
+    struct queue_t *queue;
 
-    shutdown ( sock, SHUT_RDWR );
-    verbose ( "socket:%i has been shutdown\n", sock );
-    close ( sock );
-    verbose ( "socket:%i has been closed\n", sock );
-}
+    if ( !( queue = stream->queue ) )
+    {
+        return;
+    }
 
-/* NOTE: Data Queue Related Functions */
+    stream->queue = NULL;
+
+    /* Keep only a few idle queues around */
+    if ( proxy->queue_idle >= DATA_QUEUE_IDLE_LIMIT )
+    {
+        free ( queue );
+        return;
+    }
+
+    queue->next = proxy->queue_free;
+    proxy->queue_free = queue;
+    proxy->queue_idle++;
+}
 
 /**
  * Reset data queue content
@@ -515,10 +780,10 @@ int check_enough_data ( struct proxy_t *proxy, struct stream_t *stream, size_t v
 {
     UNUSED(proxy);
 
-    if ( stream->queue.len < value )
+    if ( stream->queue->len < value )
     {
         verbose ( "awaiting more bytes (%lu/%lu) from socket:%i...\n",
-            ( unsigned long ) stream->queue.len, ( unsigned long ) value, stream->fd );
+            ( unsigned long ) stream->queue->len, ( unsigned long ) value, stream->fd );
         return -1;
     }
 
@@ -527,11 +792,41 @@ int check_enough_data ( struct proxy_t *proxy, struct stream_t *stream, size_t v
 
 /* NOTE: Event Listenning Related Functions */
 
+/**
+ * Epoll busy poll parameters, missing from older headers
+ */
+struct epoll_busy_params
+{
+    uint32_t busy_poll_usecs;
+    uint16_t busy_poll_budget;
+    uint8_t prefer_busy_poll;
+    uint8_t pad;
+};
+
+#ifndef EPIOCSPARAMS
+#define EPIOCSPARAMS _IOW ( 0x8A, 0x01, struct epoll_busy_params )
+#endif
+
 /**
  * Setup proxy events listenning
  */
 int proxy_events_setup ( struct proxy_t *proxy )
 {
+    /* Prefer io_uring if requested */
+    if ( proxy->io_uring )
+    {
+        if ( uring_setup ( proxy ) >= 0 )
+        {
+            /* Multishot poll reports edges */
+            proxy->edge_triggered = 1;
+            proxy->epoll_fd = -1;
+            return 0;
+        }
+
+        verbose ( "io_uring not available, falling back to epoll\n" );
+        proxy->io_uring = 0;
+    }
+
     /* Create epoll fd if possible */
     if ( ( proxy->epoll_fd = epoll_create ( 0 ) ) >= 0 )
     {
@@ -549,73 +844,121 @@ int proxy_events_setup ( struct proxy_t *proxy )
         }
     }
 
+    /* Edge-triggered mode requires epoll */
+    if ( proxy->epoll_fd < 0 )
+    {
+        proxy->edge_triggered = 0;
+
+    } else if ( proxy->busy_poll )
+    {
+        struct epoll_busy_params params = { 0 };
+
+        /* Empty waits poll device queues of the sockets first, since Linux 6.9 */
+        params.busy_poll_usecs = proxy->busy_poll;
+        params.busy_poll_budget = BUSY_POLL_BUDGET;
+        params.prefer_busy_poll = 1;
+        if ( ioctl ( proxy->epoll_fd, EPIOCSPARAMS, &params ) < 0 )
+        {
+            verbose ( "epoll busy polling not available (%i)\n", errno );
+        }
+    }
+
     return 0;
 }
 
 /**
- * Build stream event list with poll
+ * Remove stream slot from poll list
  */
-int build_poll_list ( struct proxy_t *proxy, struct pollfd *poll_list, size_t *poll_len )
+static void poll_list_remove ( struct proxy_t *proxy, struct stream_t *stream )
 {
-    size_t poll_size;
-    size_t poll_rlen = 0;
-    struct stream_t *iter;
-    struct pollfd *pollref;
+    size_t slot;
+    struct stream_t *moved;
 
-    poll_size = *poll_len;
+    slot = stream->pollref - proxy->poll_list;
+    proxy->poll_len--;
 
-    /* Reset poll references */
-    for ( iter = proxy->stream_head; iter; iter = iter->next )
+    /* Move last slot into the gap */
+    if ( slot != proxy->poll_len )
     {
-        iter->pollref = NULL;
+        moved = proxy->poll_streams[proxy->poll_len];
+        proxy->poll_list[slot] = proxy->poll_list[proxy->poll_len];
+        proxy->poll_streams[slot] = moved;
+        moved->pollref = proxy->poll_list + slot;
     }
 
-    /* Append file descriptors to the poll list */
-    for ( iter = proxy->stream_head; iter; iter = iter->next )
+    stream->pollref = NULL;
+}
+
+/**
+ * Build stream event list with poll
+ */
+int build_poll_list ( struct proxy_t *proxy )
+{
+    struct stream_t *iter;
+    struct pollfd *pollref;
+
+    /* Patch slots of dirty streams only */
+    while ( ( iter = stream_pop_dirty ( proxy ) ) )
     {
-        /* Assert poll list index */
-        if ( poll_rlen >= poll_size )
+        if ( iter->abandoned )
         {
-            failure ( "poll list capacity exceeded\n" );
-            return -1;
+            continue;
         }
 
-        /* Add stream to poll list if applicable */
         if ( iter->events )
         {
-            pollref = poll_list + poll_rlen;
-            pollref->fd = iter->fd;
+            if ( !( pollref = iter->pollref ) )
+            {
+                /* Assert poll list index */
+                if ( proxy->poll_len >= proxy->stream_limit )
+                {
+                    failure ( "poll list capacity exceeded\n" );
+                    return -1;
+                }
+
+                pollref = proxy->poll_list + proxy->poll_len;
+                pollref->fd = iter->fd;
+                proxy->poll_streams[proxy->poll_len++] = iter;
+                iter->pollref = pollref;
+            }
+
             pollref->events = POLLERR | POLLHUP | iter->events;
-            iter->pollref = pollref;
-            poll_rlen++;
-            verbose ( "poll list push socket:%i with events: %s%s%s%s\n", pollref->fd,
+            verbose ( "poll list set socket:%i with events: %s%s%s%s\n", pollref->fd,
                 POLL_EVENTS_TO_4xSTR ( pollref->events ) );
+
+        } else if ( iter->pollref )
+        {
+            verbose ( "poll list removed socket:%i\n", iter->fd );
+            poll_list_remove ( proxy, iter );
         }
     }
 
-    verbose ( "poll list length is %lu event(s)\n", ( unsigned long ) poll_rlen );
-    *poll_len = poll_rlen;
-
     return 0;
 }
 
 /**
  * Update streams revents with poll
  */
-void update_revents_poll ( struct proxy_t *proxy )
+void update_revents_poll ( struct proxy_t *proxy, int nfds )
 {
-    struct stream_t *iter;
+    size_t slot;
+    struct stream_t *stream;
 
-    for ( iter = proxy->stream_head; iter; iter = iter->next )
+    /* Stop once all returned events are found */
+    for ( slot = 0; slot < proxy->poll_len && nfds > 0; slot++ )
     {
-        iter->revents = iter->pollref ? iter->pollref->revents : 0;
-        if ( proxy->verbose )
+        if ( proxy->poll_list[slot].revents )
         {
-            if ( iter->revents )
-            {
-                verbose ( "events returned for socket:%i: %s%s%s%s\n", iter->fd,
-                    POLL_EVENTS_TO_4xSTR ( iter->revents ) );
-            }
+            stream = proxy->poll_streams[slot];
+            stream->revents = proxy->poll_list[slot].revents;
+
+            /* Input stays known readable until a read comes up short */
+            stream->readiness |= stream->revents & POLLIN;
+            stream_set_ready ( proxy, stream );
+            nfds--;
+
+            verbose ( "events returned for socket:%i: %s%s%s%s\n", stream->fd,
+                POLL_EVENTS_TO_4xSTR ( stream->revents ) );
         }
     }
 }
@@ -626,22 +969,23 @@ void update_revents_poll ( struct proxy_t *proxy )
 int watch_streams_poll ( struct proxy_t *proxy )
 {
     int nfds;
-    size_t poll_len;
-    struct pollfd poll_list[POOL_SIZE];
 
-    /* Set poll list size */
-    poll_len = sizeof ( poll_list ) / sizeof ( struct pollfd );
-
-    /* Rebuild poll event list */
-    if ( build_poll_list ( proxy, poll_list, &poll_len ) < 0 )
+    /* Update poll event list */
+    if ( build_poll_list ( proxy ) < 0 )
     {
         failure ( "building poll list failed (%i)\n", errno );
         return -1;
     }
 
+    verbose ( "poll list length is %lu event(s)\n", ( unsigned long ) proxy->poll_len );
+
     /* Poll events */
-    if ( ( nfds = poll ( poll_list, poll_len, POLL_TIMEOUT_MSEC ) ) < 0 )
+    if ( ( nfds = poll ( proxy->poll_list, proxy->poll_len, timer_wait_msec ( proxy ) ) ) < 0 )
     {
+        if ( errno == EINTR )
+        {
+            return -1;
+        }
         failure ( "poll events failed (%i)\n", errno );
         return -1;
     }
@@ -653,7 +997,7 @@ int watch_streams_poll ( struct proxy_t *proxy )
     }
 
     /* Update stream poll revents */
-    update_revents_poll ( proxy );
+    update_revents_poll ( proxy, nfds );
 
     return nfds;
 }
@@ -727,14 +1071,49 @@ int build_epoll_list ( struct proxy_t *proxy )
     struct stream_t *iter;
     struct epoll_event event;
 
-    /* Append file descriptors to the poll list */
-    for ( iter = proxy->stream_head; iter; iter = iter->next )
+    /* Apply interest changes of dirty streams only */
+    while ( ( iter = stream_pop_dirty ( proxy ) ) )
     {
+        if ( iter->abandoned )
+        {
+            continue;
+        }
+
+        /* Edge-triggered streams are registered once */
+        if ( stream_edge_triggered ( proxy, iter ) )
+        {
+            if ( iter->events && !iter->pollref )
+            {
+                event.data.u64 = stream_ref ( iter );
+                event.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLERR | EPOLLHUP | EPOLLET;
+
+                if ( epoll_ctl ( proxy->epoll_fd, EPOLL_CTL_ADD, iter->fd, &event ) < 0 )
+                {
+                    failure ( "epoll list cannot add socket:%i in edge-triggered mode\n",
+                        iter->fd );
+                    return -1;
+                }
+
+                verbose ( "epoll list added socket:%i in edge-triggered mode\n", iter->fd );
+
+                proxy->stat_epoll_ctl++;
+                iter->pollref = EPOLLREF;
+            }
+
+            /* Dispatch at once if already known to be ready */
+            if ( ( iter->revents = iter->readiness & ( iter->events | POLLERR | POLLHUP ) ) )
+            {
+                stream_set_ready ( proxy, iter );
+            }
+
+            continue;
+        }
+
         if ( iter->events )
         {
             if ( !iter->pollref || iter->events != iter->levents )
             {
-                event.data.ptr = iter;
+                event.data.u64 = stream_ref ( iter );
                 event.events = poll_to_epoll_events ( iter->events | POLLERR | POLLHUP );
                 operation = iter->pollref ? EPOLL_CTL_MOD : EPOLL_CTL_ADD;
 
@@ -748,19 +1127,22 @@ int build_epoll_list ( struct proxy_t *proxy )
                 verbose ( "epoll list updated socket:%i with events: %s%s%s%s\n", iter->fd,
                     EPOLL_EVENTS_TO_4xSTR ( event.events ) );
 
+                proxy->stat_epoll_ctl++;
+
                 iter->levents = iter->events;
                 iter->pollref = EPOLLREF;
             }
 
         } else if ( iter->pollref )
         {
-            verbose ( "epoll list removed socket:%i\n", proxy->epoll_fd );
+            verbose ( "epoll list removed socket:%i\n", iter->fd );
 
             if ( epoll_ctl ( proxy->epoll_fd, EPOLL_CTL_DEL, iter->fd, NULL ) < 0 )
             {
                 return -1;
             }
 
+            proxy->stat_epoll_ctl++;
             iter->pollref = NULL;
         }
     }
@@ -774,171 +1156,1531 @@ int build_epoll_list ( struct proxy_t *proxy )
 void update_revents_epoll ( struct proxy_t *proxy, int nfds, struct epoll_event *events )
 {
     int i;
+    short revents;
     struct stream_t *stream;
 
-    for ( stream = proxy->stream_head; stream; stream = stream->next )
-    {
-        stream->revents = 0;
-    }
-
     for ( i = 0; i < nfds; i++ )
     {
-        if ( ( stream = events[i].data.ptr ) )
+        if ( !( stream = stream_lookup ( proxy, events[i].data.u64 ) ) )
         {
-            stream->revents = epoll_to_poll_events ( events[i].events );
+            verbose ( "stale epoll event dropped\n" );
+            continue;
+        }
 
-            if ( proxy->verbose )
+        if ( stream_edge_triggered ( proxy, stream ) )
+        {
+            /* Remember readiness until the stream would block */
+            stream->readiness |= epoll_to_poll_events ( events[i].events );
+            if ( events[i].events & EPOLLRDHUP )
             {
-                if ( stream->revents )
-                {
-                    verbose ( "events returned for socket:%i with events: %s%s%s%s\n", stream->fd,
-                        POLL_EVENTS_TO_4xSTR ( stream->revents ) );
-                }
+                stream->readiness |= POLLIN | POLLRDHUP;
+            }
+            if ( !( revents = stream->readiness & ( stream->events | POLLERR | POLLHUP ) ) )
+            {
+                continue;
             }
+
+        } else
+        {
+            revents = epoll_to_poll_events ( events[i].events );
+
+            /* Input stays known readable until a read comes up short */
+            stream->readiness |= revents & POLLIN;
         }
-    }
-}
 
-/**
+        /* Stream may be queued already by the list flush */
+        if ( !stream->revents )
+        {
+            stream_set_ready ( proxy, stream );
+        }
+
+        stream->revents = revents;
+
+        verbose ( "events returned for socket:%i with events: %s%s%s%s\n", stream->fd,
+            POLL_EVENTS_TO_4xSTR ( stream->revents ) );
+    }
+}
+
+/**
+ * Spin on empty epoll waits up to the busy poll time
+ */
+static int epoll_spin ( struct proxy_t *proxy, struct epoll_event *events )
+{
+    int nfds;
+    unsigned long long start;
+    unsigned long long now;
+
+    now = start = monotonic_usec (  );
+    proxy->stat_spins++;
+
+    do
+    {
+        if ( ( nfds = epoll_wait ( proxy->epoll_fd, events, EPOLL_BATCH, 0 ) ) )
+        {
+            break;
+        }
+        now = monotonic_usec (  );
+
+    } while ( now - start < ( unsigned long long ) proxy->busy_poll );
+
+    if ( nfds > 0 )
+    {
+        proxy->stat_spin_hits++;
+        now = monotonic_usec (  );
+    }
+
+    proxy->stat_spin_usec += now - start;
+
+    return nfds;
+}
+
+/**
  * Watch stream events with epoll
  */
-int watch_streams_epoll ( struct proxy_t *proxy )
+int watch_streams_epoll ( struct proxy_t *proxy )
+{
+    int nfds = 0;
+    int timeout;
+    size_t pending;
+    struct epoll_event events[EPOLL_BATCH];
+
+    /* Rebuild epoll event list */
+    if ( build_epoll_list ( proxy ) < 0 )
+    {
+        failure ( "building epoll list failed (%i)\n", errno );
+        return -1;
+    }
+
+    /* Streams already known to be ready */
+    pending = proxy->ready_len;
+    timeout = pending ? 0 : timer_wait_msec ( proxy );
+
+    /* Events arriving soon are taken without sleeping */
+    if ( timeout && proxy->busy_poll )
+    {
+        nfds = epoll_spin ( proxy, events );
+    }
+
+    /* E-Poll events */
+    if ( !nfds )
+    {
+        nfds = epoll_wait ( proxy->epoll_fd, events, EPOLL_BATCH, timeout );
+    }
+
+    if ( nfds < 0 )
+    {
+        if ( errno != EINTR )
+        {
+            failure ( "epoll wait failed (%i)\n", errno );
+            return -1;
+        }
+        if ( !pending )
+        {
+            return -1;
+        }
+        nfds = 0;
+    }
+
+    /* Print stats */
+    if (nfds > 0)
+    {
+        verbose ( "found %i event%s with epoll\n" , nfds, nfds == 1 ? "" : "s");
+    }
+
+    /* Update stream epoll revents */
+    update_revents_epoll ( proxy, nfds, events );
+
+    return nfds + pending;
+}
+
+/**
+ * Watch stream events
+ */
+int watch_streams ( struct proxy_t *proxy )
+{
+    if ( proxy->uring )
+    {
+        return watch_streams_uring ( proxy );
+    }
+
+    if ( proxy->epoll_fd >= 0 )
+    {
+        return watch_streams_epoll ( proxy );
+    }
+
+    return watch_streams_poll ( proxy );
+}
+
+/**
+ * Release proxy events listenning
+ */
+void proxy_events_cleanup ( struct proxy_t *proxy )
+{
+    uring_free ( proxy );
+
+    if ( proxy->epoll_fd >= 0 )
+    {
+        close ( proxy->epoll_fd );
+        proxy->epoll_fd = -1;
+    }
+}
+
+/* NOTE: Timer Related Functions */
+
+/**
+ * Update cached monotonic clock
+ */
+void proxy_clock_update ( struct proxy_t *proxy )
+{
+    struct timespec ts;
+
+    if ( clock_gettime ( CLOCK_MONOTONIC_COARSE, &ts ) < 0 )
+    {
+        clock_gettime ( CLOCK_MONOTONIC, &ts );
+    }
+
+    proxy->now = ( unsigned long long ) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/**
+ * Arm stream timer to expire after given time
+ */
+void stream_set_timer ( struct proxy_t *proxy, struct stream_t *stream, unsigned long msec )
+{
+    struct stream_t **slot;
+
+    stream_clear_timer ( proxy, stream );
+
+    /* Round up so the timer never fires early */
+    stream->deadline = ( proxy->now + msec + TIMER_TICK_MSEC - 1 ) / TIMER_TICK_MSEC;
+    slot = proxy->timer_wheel + ( stream->deadline & ( TIMER_WHEEL_SIZE - 1 ) );
+
+    if ( ( stream->timer_next = *slot ) )
+    {
+        ( *slot )->timer_link = &stream->timer_next;
+    }
+
+    stream->timer_link = slot;
+    *slot = stream;
+}
+
+/**
+ * Disarm stream timer
+ */
+void stream_clear_timer ( struct proxy_t *proxy, struct stream_t *stream )
+{
+    UNUSED ( proxy );
+
+    if ( stream->timer_link )
+    {
+        if ( ( *stream->timer_link = stream->timer_next ) )
+        {
+            stream->timer_next->timer_link = stream->timer_link;
+        }
+        stream->timer_link = NULL;
+        stream->timer_next = NULL;
+    }
+}
+
+/**
+ * Get events wait timeout until the next timer
+ */
+int timer_wait_msec ( struct proxy_t *proxy )
+{
+    unsigned long i;
+    unsigned long tick;
+    unsigned long long wakeup;
+
+    tick = proxy->now / TIMER_TICK_MSEC;
+
+    /* Nearest busy slot bounds the next expiry */
+    for ( i = 1; i < TIMER_WHEEL_SIZE && i * TIMER_TICK_MSEC < POLL_TIMEOUT_MSEC; i++ )
+    {
+        if ( proxy->timer_wheel[( tick + i ) & ( TIMER_WHEEL_SIZE - 1 )] )
+        {
+            wakeup = ( unsigned long long ) ( tick + i ) * TIMER_TICK_MSEC;
+            return wakeup > proxy->now ? ( int ) ( wakeup - proxy->now ) : 0;
+        }
+    }
+
+    /* Kernel relayed data is accounted every tick */
+    if ( sockmap_relations ( proxy ) )
+    {
+        wakeup = ( unsigned long long ) ( tick + 1 ) * TIMER_TICK_MSEC;
+        return wakeup > proxy->now ? ( int ) ( wakeup - proxy->now ) : 0;
+    }
+
+    return POLL_TIMEOUT_MSEC;
+}
+
+/**
+ * Handle expired stream timer
+ */
+static void stream_timer_expired ( struct proxy_t *proxy, struct stream_t *stream )
+{
+    unsigned long idle;
+
+    /* Idle deadline moves with relation activity */
+    if ( stream->level == LEVEL_FORWARDING || stream->level == LEVEL_ASSOCIATED )
+    {
+        idle = ( proxy->idle_timeout * 1000 + TIMER_TICK_MSEC - 1 ) / TIMER_TICK_MSEC;
+        if ( stream->active + idle > proxy->now / TIMER_TICK_MSEC )
+        {
+            stream_set_timer ( proxy, stream,
+                ( stream->active + idle ) * TIMER_TICK_MSEC - proxy->now );
+            return;
+        }
+        verbose ( "relation with socket:%i is idle for too long\n", stream->fd );
+
+    } else
+    {
+        verbose ( "stream with socket:%i timed out at level %i\n", stream->fd, stream->level );
+    }
+
+    remove_relation ( proxy, stream );
+}
+
+/**
+ * Expire stream timers due
+ */
+void expire_timers ( struct proxy_t *proxy )
+{
+    unsigned long tick;
+    struct stream_t *iter;
+    struct stream_t *next;
+
+    tick = proxy->now / TIMER_TICK_MSEC;
+
+    /* Visit every slot at most once after a long sleep */
+    if ( tick - proxy->timer_tick >= TIMER_WHEEL_SIZE )
+    {
+        proxy->timer_tick = tick - TIMER_WHEEL_SIZE + 1;
+    }
+
+    for ( ; proxy->timer_tick <= tick; proxy->timer_tick++ )
+    {
+        for ( iter = proxy->timer_wheel[proxy->timer_tick & ( TIMER_WHEEL_SIZE - 1 )]; iter;
+            iter = next )
+        {
+            next = iter->timer_next;
+
+            /* Slot is shared with later wheel rounds */
+            if ( iter->deadline <= tick )
+            {
+                stream_clear_timer ( proxy, iter );
+                stream_timer_expired ( proxy, iter );
+            }
+        }
+    }
+}
+
+/* NOTE: Loop Monitoring Related Functions */
+
+/**
+ * Get monotonic time in microseconds
+ */
+unsigned long long monotonic_usec ( void )
+{
+    struct timespec ts;
+
+    clock_gettime ( CLOCK_MONOTONIC, &ts );
+
+    return ( unsigned long long ) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/**
+ * Count duration into log2 histogram bucket
+ */
+static void histogram_add ( unsigned long *hist, unsigned long long usec )
+{
+    int bucket = 0;
+
+    /* Bucket N holds durations below 2^N usec */
+    while ( usec && bucket < LOOP_HIST_BUCKETS - 1 )
+    {
+        usec >>= 1;
+        bucket++;
+    }
+
+    hist[bucket]++;
+}
+
+/**
+ * Record loop wakeup
+ */
+void loop_wakeup ( struct proxy_t *proxy )
+{
+    unsigned long long now;
+
+    now = monotonic_usec (  );
+
+    if ( proxy->loop_wakeup )
+    {
+        histogram_add ( proxy->hist_gap, now - proxy->loop_wakeup );
+    }
+
+    proxy->loop_wakeup = now;
+    proxy->slow_usec = 0;
+}
+
+/**
+ * Record single stream dispatch time
+ */
+void loop_stream_done ( struct proxy_t *proxy, int fd, int role, int level,
+    unsigned long long start )
+{
+    unsigned long long usec;
+
+    /* Remember the slowest stream of the iteration */
+    if ( ( usec = monotonic_usec (  ) - start ) > proxy->slow_usec )
+    {
+        proxy->slow_usec = usec;
+        proxy->slow_fd = fd;
+        proxy->slow_role = role;
+        proxy->slow_level = level;
+        memcpy ( proxy->slow_host, proxy->dispatch_host, sizeof ( proxy->slow_host ) );
+    }
+}
+
+/**
+ * Record loop dispatch time and report stalls
+ */
+void loop_dispatched ( struct proxy_t *proxy )
+{
+    unsigned long long usec;
+
+    usec = monotonic_usec (  ) - proxy->loop_wakeup;
+    histogram_add ( proxy->hist_dispatch, usec );
+
+    /* Smoothed lag drives admission */
+    proxy->loop_lag = ( proxy->loop_lag * 7 + usec ) / 8;
+
+    if ( proxy->stall_threshold && usec >= ( unsigned long long ) proxy->stall_threshold * 1000 )
+    {
+        proxy->stat_stalls++;
+
+        if ( proxy->slow_usec )
+        {
+            failure ( "loop stalled for %llu ms, socket:%i took %llu ms at %s stage%s%s\n",
+                usec / 1000, proxy->slow_fd, proxy->slow_usec / 1000,
+                stream_stage ( proxy->slow_role, proxy->slow_level ),
+                proxy->slow_host[0] ? " resolving " : "", proxy->slow_host );
+
+        } else
+        {
+            failure ( "loop stalled for %llu ms outside stream dispatch\n", usec / 1000 );
+        }
+    }
+}
+
+/* NOTE: Admission Related Functions */
+
+/**
+ * Check if loop lags too much to take new clients
+ */
+int admission_lagging ( struct proxy_t *proxy )
+{
+    return proxy->shed_lag && proxy->loop_lag >= ( unsigned long long ) proxy->shed_lag * 1000;
+}
+
+/**
+ * Check if stream pool is too crowded for new relations
+ */
+int admission_crowded ( struct proxy_t *proxy )
+{
+    return proxy->shed_occupancy
+        && proxy->stream_count * 100 >= proxy->stream_limit * proxy->shed_occupancy;
+}
+
+/* NOTE: Stream Related Functions */
+
+/**
+ * Raise open files limit as far as allowed
+ */
+static rlim_t raise_nofile_limit ( struct proxy_t *proxy, rlim_t wanted )
+{
+    struct rlimit limit;
+
+    if ( getrlimit ( RLIMIT_NOFILE, &limit ) < 0 )
+    {
+        failure ( "cannot get open files limit (%i)\n", errno );
+        return 0;
+    }
+
+    if ( limit.rlim_max != RLIM_INFINITY && wanted > limit.rlim_max )
+    {
+        wanted = limit.rlim_max;
+    }
+
+    if ( wanted > limit.rlim_cur )
+    {
+        limit.rlim_cur = wanted;
+        if ( setrlimit ( RLIMIT_NOFILE, &limit ) < 0 )
+        {
+            verbose ( "cannot raise open files limit (%i)\n", errno );
+            getrlimit ( RLIMIT_NOFILE, &limit );
+        }
+    }
+
+    return limit.rlim_cur;
+}
+
+/**
+ * Setup stream pool sized by connections limit
+ */
+int stream_pool_setup ( struct proxy_t *proxy )
+{
+    rlim_t nofile;
+    size_t needed;
+    size_t reserved;
+
+    /* Idle splice pipes hold two descriptors each */
+    reserved = FD_RESERVED + ( proxy->splice ? SPLICE_PIPE_IDLE_LIMIT * 2 : 0 );
+
+    /* Two sockets per relation plus some reserve */
+    if ( proxy->max_conns )
+    {
+        needed = proxy->max_conns * 2 + reserved;
+        if ( ( nofile = raise_nofile_limit ( proxy, needed ) ) < needed )
+        {
+            failure ( "open files limit %lu is too low for %lu connection(s)\n",
+                ( unsigned long ) nofile, ( unsigned long ) proxy->max_conns );
+        }
+
+    } else
+    {
+        nofile = raise_nofile_limit ( proxy, MAX_CONNS_LIMIT * 2 + reserved );
+        proxy->max_conns = nofile > reserved + 2 ? ( nofile - reserved ) / 2 : 1;
+        if ( proxy->max_conns > MAX_CONNS_LIMIT )
+        {
+            proxy->max_conns = MAX_CONNS_LIMIT;
+        }
+    }
+
+    /* One more stream for the listen socket */
+    proxy->stream_limit = proxy->max_conns * 2 + 1;
+    proxy->stream_total = 0;
+    proxy->stream_count = 0;
+    proxy->slab_count = 0;
+    proxy->free_head = NULL;
+    proxy->queue_free = NULL;
+    proxy->queue_idle = 0;
+    proxy->chunks = NULL;
+    proxy->chunk_free = NULL;
+    proxy->chunk_idle = 0;
+    proxy->tune_used = 0;
+    proxy->pipes = NULL;
+    proxy->pipe_free = NULL;
+    proxy->pipe_idle = 0;
+    memset ( proxy->stream_head, '\0', sizeof ( proxy->stream_head ) );
+    memset ( proxy->stream_tail, '\0', sizeof ( proxy->stream_tail ) );
+    proxy->dirty_head = NULL;
+    proxy->abandoned_head = NULL;
+    proxy->ready_len = 0;
+    proxy->ready_start = 0;
+    proxy->budget = FORWARD_QUANTUM;
+    proxy->poll_len = 0;
+    memset ( proxy->timer_wheel, '\0', sizeof ( proxy->timer_wheel ) );
+    proxy_clock_update ( proxy );
+    proxy->timer_tick = proxy->now / TIMER_TICK_MSEC;
+
+    if ( source_table_setup ( proxy ) < 0
+        || sockmap_setup ( proxy ) < 0
+        || flow_table_setup ( proxy ) < 0
+        || profile_table_setup ( proxy ) < 0
+        || !( proxy->chunks = ( struct chunk_t ** ) calloc ( proxy->stream_limit,
+                sizeof ( struct chunk_t * ) ) )
+        || ( proxy->splice && !( proxy->pipes = ( struct pipe_t ** ) calloc ( proxy->stream_limit,
+                    sizeof ( struct pipe_t * ) ) ) )
+        || !( proxy->slabs = ( struct stream_t ** ) calloc ( ( proxy->stream_limit +
+                    STREAM_SLAB_SIZE - 1 ) / STREAM_SLAB_SIZE, sizeof ( struct stream_t * ) ) )
+        || !( proxy->ready = ( struct stream_t ** ) calloc ( proxy->stream_limit,
+                sizeof ( struct stream_t * ) ) ) )
+    {
+        stream_pool_free ( proxy );
+        return -1;
+    }
+
+    /* Poll list is needed only without epoll or io_uring */
+    if ( proxy->epoll_fd < 0 && !proxy->uring )
+    {
+        if ( !( proxy->poll_streams = ( struct stream_t ** ) calloc ( proxy->stream_limit,
+                    sizeof ( struct stream_t * ) ) )
+            || !( proxy->poll_list = ( struct pollfd * ) calloc ( proxy->stream_limit,
+                    sizeof ( struct pollfd ) ) ) )
+        {
+            stream_pool_free ( proxy );
+            return -1;
+        }
+    }
+
+    verbose ( "stream pool setup for %lu connection(s)\n", ( unsigned long ) proxy->max_conns );
+
+    return 0;
+}
+
+/**
+ * Release stream pool
+ */
+void stream_pool_free ( struct proxy_t *proxy )
+{
+    size_t i;
+    struct queue_t *queue;
+    struct pipe_t *pipe;
+    struct chunk_t *chunk;
+
+    while ( ( queue = proxy->queue_free ) )
+    {
+        proxy->queue_free = queue->next;
+        free ( queue );
+    }
+    proxy->queue_idle = 0;
+
+    while ( ( pipe = proxy->pipe_free ) )
+    {
+        proxy->pipe_free = pipe->next;
+        pipe_destroy ( pipe );
+    }
+    proxy->pipe_idle = 0;
+
+    while ( ( chunk = proxy->chunk_free ) )
+    {
+        proxy->chunk_free = chunk->next;
+        free ( chunk );
+    }
+    proxy->chunk_idle = 0;
+
+    if ( proxy->slabs )
+    {
+        for ( i = 0; i < proxy->slab_count; i++ )
+        {
+            free ( proxy->slabs[i] );
+        }
+        free ( proxy->slabs );
+        proxy->slabs = NULL;
+    }
+
+    source_table_free ( proxy );
+    sockmap_free ( proxy );
+    flow_table_free ( proxy );
+    profile_table_free ( proxy );
+    udp_free ( proxy );
+    free ( proxy->chunks );
+    free ( proxy->pipes );
+    free ( proxy->ready );
+    free ( proxy->poll_streams );
+    free ( proxy->poll_list );
+    proxy->chunks = NULL;
+    proxy->pipes = NULL;
+    proxy->ready = NULL;
+    proxy->poll_streams = NULL;
+    proxy->poll_list = NULL;
+    proxy->slab_count = 0;
+    proxy->stream_total = 0;
+    proxy->free_head = NULL;
+}
+
+/**
+ * Allocate next slab of stream slots
+ */
+static int stream_pool_grow ( struct proxy_t *proxy )
+{
+    size_t i;
+    size_t count;
+    void *mem;
+    uint8_t *slab;
+    struct stream_t *stream;
+
+    if ( proxy->stream_total >= proxy->stream_limit )
+    {
+        return -1;
+    }
+
+    if ( ( count = proxy->stream_limit - proxy->stream_total ) > STREAM_SLAB_SIZE )
+    {
+        count = STREAM_SLAB_SIZE;
+    }
+
+    /* Align slab so that each stream starts a cache line */
+    if ( ( errno = posix_memalign ( &mem, CACHE_LINE_SIZE, count * proxy->stream_size ) ) )
+    {
+        failure ( "cannot allocate stream slab (%i)\n", errno );
+        return -1;
+    }
+
+    slab = ( uint8_t * ) mem;
+    memset ( slab, '\0', count * proxy->stream_size );
+
+    proxy->slabs[proxy->slab_count++] = ( struct stream_t * ) slab;
+
+    /* Free slots are chained by next pointer */
+    for ( i = count; i--; )
+    {
+        stream = ( struct stream_t * ) ( slab + i * proxy->stream_size );
+        stream->index = proxy->stream_total + i;
+        stream->next = proxy->free_head;
+        proxy->free_head = stream;
+    }
+
+    proxy->stream_total += count;
+
+    verbose ( "stream pool grown to %lu slot(s)\n", ( unsigned long ) proxy->stream_total );
+
+    return 0;
+}
+
+/**
+ * Encode stream slot index and generation
+ */
+uint64_t stream_ref ( const struct stream_t *stream )
+{
+    return ( ( uint64_t ) stream->generation << 32 ) | stream->index;
+}
+
+/**
+ * Decode stream reference into a live stream
+ */
+struct stream_t *stream_lookup ( struct proxy_t *proxy, uint64_t ref )
+{
+    size_t index;
+    struct stream_t *stream;
+
+    if ( ( index = ref & STREAM_INDEX_MASK ) >= proxy->stream_total )
+    {
+        return NULL;
+    }
+
+    stream = ( struct stream_t * ) ( ( ( uint8_t * ) proxy->slabs[index / STREAM_SLAB_SIZE] ) +
+        ( index % STREAM_SLAB_SIZE ) * proxy->stream_size );
+
+    /* Reference may belong to a stream slot already reused */
+    if ( !stream->allocated || stream->generation != ( unsigned int ) ( ref >> 32 ) )
+    {
+        return NULL;
+    }
+
+    return stream;
+}
+
+/**
+ * Queue stream for the next events list flush
+ */
+void stream_set_dirty ( struct proxy_t *proxy, struct stream_t *stream )
+{
+    if ( !stream->dirty )
+    {
+        stream->dirty = 1;
+
+        if ( ( stream->dirty_next = proxy->dirty_head ) )
+        {
+            proxy->dirty_head->dirty_link = &stream->dirty_next;
+        }
+
+        stream->dirty_link = &proxy->dirty_head;
+        proxy->dirty_head = stream;
+    }
+}
+
+/**
+ * Take next stream from the dirty list
+ */
+struct stream_t *stream_pop_dirty ( struct proxy_t *proxy )
+{
+    struct stream_t *stream;
+
+    if ( ( stream = proxy->dirty_head ) )
+    {
+        if ( ( proxy->dirty_head = stream->dirty_next ) )
+        {
+            proxy->dirty_head->dirty_link = &proxy->dirty_head;
+        }
+
+        stream->dirty_next = NULL;
+        stream->dirty_link = NULL;
+        stream->dirty = 0;
+    }
+
+    return stream;
+}
+
+/**
+ * Queue stream for dispatch in this cycle, its slot lets removal drop it at once
+ */
+void stream_set_ready ( struct proxy_t *proxy, struct stream_t *stream )
+{
+    stream->ready_slot = proxy->ready_len;
+    proxy->ready[proxy->ready_len++] = stream;
+}
+
+/**
+ * Update stream events interest
+ */
+void stream_set_events ( struct proxy_t *proxy, struct stream_t *stream, short events )
+{
+    if ( stream->events == events )
+    {
+        return;
+    }
+
+    stream->events = events;
+    stream_set_dirty ( proxy, stream );
+}
+
+/**
+ * Check if stream is watched in edge-triggered mode
+ */
+int stream_edge_triggered ( struct proxy_t *proxy, const struct stream_t *stream )
+{
+    return proxy->edge_triggered && ( stream->role == S_PORT_A || stream->role == S_PORT_B );
+}
+
+/**
+ * Clear stream readiness after it would block
+ */
+void stream_clear_ready ( struct stream_t *stream, short events )
+{
+    /* Keep reading until peer shutdown is seen */
+    if ( stream->readiness & POLLRDHUP )
+    {
+        events &= ~POLLIN;
+    }
+
+    stream->readiness &= ~events;
+}
+
+/**
+ * Put stream at the head of a stream list
+ */
+static void stream_list_push ( struct proxy_t *proxy, struct stream_t *stream, int list )
+{
+    stream->list = list;
+    stream->prev = NULL;
+    stream->next = proxy->stream_head[list];
+
+    if ( proxy->stream_head[list] )
+    {
+        proxy->stream_head[list]->prev = stream;
+
+    } else
+    {
+        proxy->stream_tail[list] = stream;
+    }
+
+    proxy->stream_head[list] = stream;
+}
+
+/**
+ * Take stream out of its stream list
+ */
+static void stream_list_unlink ( struct proxy_t *proxy, struct stream_t *stream )
+{
+    if ( stream == proxy->stream_head[stream->list] )
+    {
+        proxy->stream_head[stream->list] = stream->next;
+    }
+
+    if ( stream == proxy->stream_tail[stream->list] )
+    {
+        proxy->stream_tail[stream->list] = stream->prev;
+    }
+
+    if ( stream->next )
+    {
+        stream->next->prev = stream->prev;
+    }
+
+    if ( stream->prev )
+    {
+        stream->prev->next = stream->next;
+    }
+}
+
+/**
+ * Move stream to the head of a stream list, least recent stay at the tail
+ */
+void stream_set_list ( struct proxy_t *proxy, struct stream_t *stream, int list )
+{
+    if ( stream->list == list && stream == proxy->stream_head[list] )
+    {
+        return;
+    }
+
+    stream_list_unlink ( proxy, stream );
+    stream_list_push ( proxy, stream, list );
+}
+
+/**
+ * Insert new stream structure into the list
+ */
+struct stream_t *insert_stream ( struct proxy_t *proxy, int sock )
+{
+    unsigned int index;
+    unsigned int generation;
+    struct stream_t *stream;
+
+    if ( !proxy->free_head && stream_pool_grow ( proxy ) < 0 )
+    {
+        failure ( "stream pool is full\n" );
+        return NULL;
+    }
+
+    stream = proxy->free_head;
+    proxy->free_head = stream->next;
+
+    /* Keep slot generation to detect stale references */
+    index = stream->index;
+    generation = stream->generation + 1;
+    memset ( stream, '\0', proxy->stream_size );
+    stream->index = index;
+    stream->generation = generation;
+    stream->role = S_INVALID;
+    stream->fd = sock;
+    stream->level = LEVEL_NONE;
+    stream->allocated = 1;
+    stream->active = proxy->now / TIMER_TICK_MSEC;
+    stream_list_push ( proxy, stream, LIST_OTHER );
+    proxy->stream_count++;
+
+    verbose ( "created new stream with socket:%i\n", sock );
+
+    return stream;
+}
+
+/**
+ * Check if accept failed only for lack of pending connections
+ */
+int accept_would_block ( int err )
+{
+    return err == EAGAIN || err == EWOULDBLOCK || err == EINTR || err == ECONNABORTED;
+}
+
+/**
+ * Accept a new stream
+ */
+struct stream_t *accept_new_stream ( struct proxy_t *proxy, int lfd,
+    struct sockaddr_storage *saddr )
+{
+    int sock;
+    int cpu;
+    socklen_t len;
+    socklen_t addrlen;
+    struct stream_t *stream;
+
+    /* Accept incoming connection already non-blocking */
+    addrlen = sizeof ( struct sockaddr_storage );
+    if ( ( sock = proxy->uring ? uring_accept ( proxy ) : accept4 ( lfd,
+                ( struct sockaddr * ) saddr, saddr ? &addrlen : NULL,
+                SOCK_NONBLOCK | SOCK_CLOEXEC ) ) < 0 )
+    {
+        if ( !accept_would_block ( errno ) )
+        {
+            failure ( "cannot accept incoming connection (%i) on socket:%i\n", errno, lfd );
+        }
+        return NULL;
+    }
+
+    /* Multishot accept does not report the client address */
+    if ( saddr && proxy->uring )
+    {
+        addrlen = sizeof ( struct sockaddr_storage );
+        if ( getpeername ( sock, ( struct sockaddr * ) saddr, &addrlen ) < 0 )
+        {
+            saddr->ss_family = AF_UNSPEC;
+        }
+    }
+
+    socket_set_busy_poll ( proxy, sock );
+
+#ifdef SO_INCOMING_CPU
+    /* Check if connection was steered to this CPU */
+    if ( proxy->cpu_pinning )
+    {
+        len = sizeof ( cpu );
+        if ( getsockopt ( sock, SOL_SOCKET, SO_INCOMING_CPU, &cpu, &len ) >= 0
+            && cpu == proxy->worker_cpu )
+        {
+            proxy->stat_cpu_local++;
+        }
+    }
+#else
+    UNUSED ( cpu );
+    UNUSED ( len );
+#endif
+
+    /* Try allocating new stream */
+    if ( !( stream = insert_stream ( proxy, sock ) ) )
+    {
+        verbose ( "stream pool is full, need to force cleanup...\n" );
+        force_cleanup ( proxy, NULL );
+        stream = insert_stream ( proxy, sock );
+    }
+
+    /* Check if stream was allocated */
+    if ( !stream )
+    {
+        shutdown_then_close ( proxy, sock );
+        errno = ENOBUFS;
+        return NULL;
+    }
+
+    proxy->stat_accepted++;
+
+    return stream;
+}
+
+/**
+ * Check if more data may be read from the stream
+ */
+static int relay_readable ( struct proxy_t *proxy, const struct stream_t *stream )
+{
+    struct chunk_t *chunk;
+
+    /* Pipe is refilled only once drained */
+    if ( proxy->pipes && proxy->pipes[stream->index] )
+    {
+        return 0;
+    }
+
+    /* Read again once backlog drops to the low watermark */
+    return !( chunk = proxy->chunks[stream->index] )
+        || ( !chunk->eof && chunk->len <= chunk->size / FORWARD_LOW_WATER_DIV );
+}
+
+/**
+ * Get data read from the stream but not yet sent
+ */
+static size_t relay_pending ( struct proxy_t *proxy, const struct stream_t *stream )
+{
+    if ( proxy->pipes && proxy->pipes[stream->index] )
+    {
+        return proxy->pipes[stream->index]->len;
+    }
+
+    /* Peer close to be passed on counts as pending as well */
+    return proxy->chunks[stream->index]
+        ? proxy->chunks[stream->index]->len + proxy->chunks[stream->index]->eof : 0;
+}
+
+/**
+ * Splice data from the stream into an empty pipe
+ */
+static int relay_splice_recv ( struct proxy_t *proxy, struct stream_t *src )
+{
+    ssize_t len;
+    size_t room;
+    struct pipe_t *pipe;
+
+    if ( !( pipe = pipe_acquire ( proxy, src ) ) )
+    {
+        return -2;
+    }
+
+    /* Relation takes no more than its quantum per dispatch */
+    room = pipe->size < proxy->budget ? pipe->size : proxy->budget;
+
+    if ( ( len = splice ( src->fd, NULL, pipe->fd[1], NULL, room,
+                SPLICE_F_MOVE | SPLICE_F_NONBLOCK ) ) < 0 )
+    {
+        pipe_release ( proxy, src );
+        if ( errno == EAGAIN || errno == EWOULDBLOCK )
+        {
+            stream_clear_ready ( src, POLLIN );
+            return 0;
+        }
+        failure ( "cannot splice data from socket:%i (%i)\n", src->fd, errno );
+        return -1;
+    }
+
+    if ( !len )
+    {
+        pipe_release ( proxy, src );
+        verbose ( "lost connection on socket:%i\n", src->fd );
+        return -1;
+    }
+
+    /* Pipe not filled up means the socket was drained */
+    if ( ( size_t ) len < room )
+    {
+        stream_clear_ready ( src, POLLIN );
+    }
+
+    pipe->len = len;
+    proxy->budget -= len;
+
+    if ( proxy->flows )
+    {
+        flow_count_read ( proxy, src );
+    }
+
+    return len;
+}
+
+/**
+ * Read data from the stream into its chunk
+ */
+static int relay_chunk_recv ( struct proxy_t *proxy, struct stream_t *src )
+{
+    ssize_t len;
+    size_t room;
+    struct chunk_t *chunk;
+
+    if ( !( chunk = chunk_acquire ( proxy, src ) ) )
+    {
+        return -1;
+    }
+
+    /* Move the backlog, at most the low watermark, to the chunk start */
+    if ( chunk->off )
+    {
+        memmove ( chunk->arr, chunk->arr + chunk->off, chunk->len );
+        chunk->off = 0;
+    }
+
+    room = chunk->size - chunk->len;
+
+    /* Relation takes no more than its quantum per dispatch */
+    if ( room > proxy->budget )
+    {
+        room = proxy->budget;
+    }
+
+    if ( ( len = recv ( src->fd, chunk->arr + chunk->len, room, 0 ) ) < 0 )
+    {
+        if ( errno == EAGAIN || errno == EWOULDBLOCK )
+        {
+            stream_clear_ready ( src, POLLIN );
+
+            /* Unsent backlog stays with the stream */
+            if ( !chunk->len )
+            {
+                chunk_release ( proxy, src );
+            }
+            return 0;
+        }
+        failure ( "cannot receive data from socket:%i (%i)\n", src->fd, errno );
+        return -1;
+    }
+
+    if ( !len )
+    {
+        verbose ( "lost connection on socket:%i\n", src->fd );
+
+        /* Backlog is still sent before the relation is closed */
+        if ( chunk->len || ( proxy->sockmap && sockmap_backlog ( proxy, src->neighbour ) ) )
+        {
+            chunk->eof = 1;
+            return 0;
+        }
+
+        chunk_release ( proxy, src );
+        return -1;
+    }
+
+    /* Short read means the socket was drained */
+    if ( ( size_t ) len < room )
+    {
+        stream_clear_ready ( src, POLLIN );
+    }
+
+    chunk->len += len;
+    proxy->budget -= len;
+
+    if ( proxy->flows )
+    {
+        flow_count_read ( proxy, src );
+    }
+
+    return len;
+}
+
+/**
+ * Read data from the stream
+ */
+static int relay_recv ( struct proxy_t *proxy, struct stream_t *src )
+{
+    int len;
+
+    /* Quantum spent, the rest waits for the next round */
+    if ( !proxy->budget )
+    {
+        return 0;
+    }
+
+    /* Backlog taken while no pipe was available is sent first, data
+       kept by the sockmap verdict can only be received */
+    if ( proxy->pipes && !proxy->chunks[src->index]
+        && !( proxy->sockmap && sockmap_mapped ( proxy, src ) )
+        && ( len = relay_splice_recv ( proxy, src ) ) != -2 )
+    {
+        return len;
+    }
+
+    return relay_chunk_recv ( proxy, src );
+}
+
+/**
+ * Send data read from the source stream
+ */
+static int relay_send ( struct proxy_t *proxy, struct stream_t *src, struct stream_t *dst )
+{
+    ssize_t len;
+    struct pipe_t *pipe;
+    struct chunk_t *chunk;
+
+    /* Handshake reply and kernel relayed data go out first */
+    if ( ( dst->queue && dst->queue->len )
+        || ( proxy->sockmap && sockmap_backlog ( proxy, dst ) ) )
+    {
+        return 0;
+    }
+
+    if ( proxy->pipes && ( pipe = proxy->pipes[src->index] ) )
+    {
+        if ( ( len = splice ( pipe->fd[0], NULL, dst->fd, NULL, pipe->len,
+                    SPLICE_F_MOVE | SPLICE_F_NONBLOCK ) ) < 0 )
+        {
+            if ( errno == EAGAIN || errno == EWOULDBLOCK )
+            {
+                stream_clear_ready ( dst, POLLOUT );
+                return 0;
+            }
+            failure ( "cannot splice data to socket:%i (%i)\n", dst->fd, errno );
+            return -1;
+        }
+
+        proxy->stat_spliced += len;
+
+        if ( ( pipe->len -= len ) )
+        {
+            stream_clear_ready ( dst, POLLOUT );
+
+        } else
+        {
+            pipe_release ( proxy, src );
+        }
+
+    } else if ( ( chunk = proxy->chunks[src->index] ) && chunk->eof && !chunk->len )
+    {
+        /* Peer close waited only for kernel relayed data */
+        chunk_release ( proxy, src );
+        return -1;
+
+    } else if ( chunk )
+    {
+        if ( ( len = send ( dst->fd, chunk->arr + chunk->off, chunk->len,
+                    MSG_NOSIGNAL ) ) < 0 )
+        {
+            if ( errno == EAGAIN || errno == EWOULDBLOCK )
+            {
+                stream_clear_ready ( dst, POLLOUT );
+                return 0;
+            }
+            failure ( "cannot send data to socket:%i (%i)\n", dst->fd, errno );
+            return -1;
+        }
+
+        chunk->off += len;
+        chunk->len -= len;
+
+        /* Short send means the socket would block */
+        if ( chunk->len )
+        {
+            stream_clear_ready ( dst, POLLOUT );
+
+        } else if ( chunk->eof )
+        {
+            chunk_release ( proxy, src );
+            proxy->stat_forwarded += len;
+            return -1;
+
+        } else
+        {
+            chunk_release ( proxy, src );
+        }
+
+    } else
+    {
+        return 0;
+    }
+
+    verbose ( "forwarded %i byte(s) from socket:%i to socket:%i\n", ( int ) len, src->fd,
+        dst->fd );
+
+    proxy->stat_forwarded += len;
+
+    return len;
+}
+
+/**
+ * Relay data between edge-triggered streams until neither can progress
+ */
+static int relay_stream_edge ( struct proxy_t *proxy, struct stream_t *src,
+    struct stream_t *dst )
+{
+    int len;
+    int progress;
+
+    do
+    {
+        progress = 0;
+
+        if ( ( src->readiness & POLLIN ) && relay_readable ( proxy, src ) )
+        {
+            if ( ( len = relay_recv ( proxy, src ) ) < 0 )
+            {
+                return -1;
+            }
+            progress |= len > 0;
+        }
+
+        if ( ( dst->readiness & POLLOUT ) && relay_pending ( proxy, src ) )
+        {
+            if ( ( len = relay_send ( proxy, src, dst ) ) < 0 )
+            {
+                return -1;
+            }
+            progress |= len > 0;
+        }
+
+    } while ( progress );
+
+    return 0;
+}
+
+/**
+ * Requeue edge-triggered stream with input left over the quantum
+ */
+static void relay_defer ( struct proxy_t *proxy, struct stream_t *stream )
 {
-    int nfds;
-    struct epoll_event events[POOL_SIZE];
-
-    /* Rebuild epoll event list */
-    if ( build_epoll_list ( proxy ) < 0 )
+    if ( ( stream->readiness & POLLIN ) && relay_readable ( proxy, stream ) )
     {
-        failure ( "building epoll list failed (%i)\n", errno );
-        return -1;
+        stream_set_dirty ( proxy, stream );
+        proxy->stat_deferred++;
     }
+}
 
-    /* E-Poll events */
-    if ( ( nfds = epoll_wait ( proxy->epoll_fd, events, POOL_SIZE, POLL_TIMEOUT_MSEC ) ) < 0 )
+/**
+ * Relay data between edge-triggered streams, each direction taking half the quantum
+ */
+static int relay_stream_pair ( struct proxy_t *proxy, struct stream_t *stream )
+{
+    size_t half = proxy->budget / 2;
+
+    /* What the first direction leaves is given to the other */
+    proxy->budget -= half;
+    if ( relay_stream_edge ( proxy, stream, stream->neighbour ) < 0 )
     {
-        failure ( "epoll wait failed (%i)\n", errno );
         return -1;
     }
 
-    /* Print stats */
-    if (nfds > 0)
+    proxy->budget += half;
+    if ( relay_stream_edge ( proxy, stream->neighbour, stream ) < 0 )
     {
-        verbose ( "found %i event%s with epoll\n" , nfds, nfds == 1 ? "" : "s");
+        return -1;
     }
 
-    /* Update stream epoll revents */
-    update_revents_epoll ( proxy, nfds, events );
+    /* Listed streams are dispatched from readiness on the next cycle */
+    relay_defer ( proxy, stream );
+    relay_defer ( proxy, stream->neighbour );
 
-    return nfds;
+    return 0;
 }
 
 /**
- * Watch stream events
+ * Relay data on level-triggered stream events in both directions
  */
-int watch_streams ( struct proxy_t *proxy )
+static int relay_stream_level ( struct proxy_t *proxy, struct stream_t *stream )
 {
-    if ( proxy->epoll_fd >= 0 )
+    int paused;
+    struct stream_t *neighbour = stream->neighbour;
+
+    /* Input is sent right away, what does not fit is kept */
+    if ( ( stream->revents & POLLIN ) && relay_readable ( proxy, stream )
+        && ( relay_recv ( proxy, stream ) < 0 || relay_send ( proxy, stream, neighbour ) < 0 ) )
     {
-        return watch_streams_epoll ( proxy );
+        return -1;
     }
 
-    return watch_streams_poll ( proxy );
+    if ( stream->revents & POLLOUT )
+    {
+        paused = !( neighbour->events & POLLIN );
+
+        if ( relay_send ( proxy, neighbour, stream ) < 0 )
+        {
+            return -1;
+        }
+
+        /* Input paused by backlog and known readable is taken at once, not a wakeup later */
+        if ( paused && ( neighbour->readiness & POLLIN )
+            && relay_readable ( proxy, neighbour )
+            && ( relay_recv ( proxy, neighbour ) < 0
+                || relay_send ( proxy, neighbour, stream ) < 0 ) )
+        {
+            return -1;
+        }
+    }
+
+    return 0;
 }
 
-/* NOTE: Stream Related Functions */
+/**
+ * Watch stream for input while it may be read, for output while it has backlog
+ */
+static void relay_update_events ( struct proxy_t *proxy, struct stream_t *stream )
+{
+    /* Kernel relayed backlog gives no events, it is polled by the sweep */
+    stream_set_events ( proxy, stream,
+        ( relay_readable ( proxy, stream ) ? POLLIN : 0 )
+        | ( ( relay_pending ( proxy, stream->neighbour )
+                && !( proxy->sockmap && sockmap_backlog ( proxy, stream ) ) )
+            || ( stream->queue && stream->queue->len ) ? POLLOUT : 0 ) );
+}
 
 /**
- * Insert new stream structure into the list
+ * TCP information with fields past the glibc structure
  */
-struct stream_t *insert_stream ( struct proxy_t *proxy, int sock )
+struct tcp_info_rate
+{
+    struct tcp_info info;
+    uint64_t pacing_rate;
+    uint64_t max_pacing_rate;
+    uint64_t bytes_acked;
+    uint64_t bytes_received;
+    uint32_t segs_out;
+    uint32_t segs_in;
+    uint32_t notsent_bytes;
+    uint32_t min_rtt;
+    uint32_t data_segs_in;
+    uint32_t data_segs_out;
+    uint64_t delivery_rate;
+};
+
+/**
+ * Estimate bandwidth-delay product of the socket path
+ */
+static size_t socket_path_bdp ( int sock )
 {
-    struct stream_t *ptr;
-    struct stream_t *lim;
-    struct stream_t *stream = NULL;
+    socklen_t len;
+    struct tcp_info_rate rate;
 
-    ptr = proxy->stream_pool;
-    lim =
-        ( struct stream_t * ) ( ( ( uint8_t * ) proxy->stream_pool ) +
-        POOL_SIZE * proxy->stream_size );
+    memset ( &rate, '\0', sizeof ( rate ) );
+    len = sizeof ( rate );
 
-    while ( ptr < lim )
+    if ( getsockopt ( sock, IPPROTO_TCP, TCP_INFO, &rate, &len ) < 0 )
     {
-        if ( !ptr->allocated )
-        {
-            stream = ptr;
-            break;
-        }
-        ptr = ( struct stream_t * ) ( ( ( uint8_t * ) ptr ) + proxy->stream_size );
+        return 0;
     }
 
-    if ( !stream )
+    /* Delivery rate over minimum RTT where the kernel reports them */
+    if ( len >= sizeof ( rate ) && rate.delivery_rate && rate.min_rtt )
     {
-        failure ( "stream pool is full\n" );
-        return NULL;
+        return rate.delivery_rate * rate.min_rtt / 1000000;
     }
 
-    memset ( stream, '\0', proxy->stream_size );
-    stream->role = S_INVALID;
-    stream->fd = sock;
-    stream->level = LEVEL_NONE;
-    stream->allocated = 1;
-    stream->next = proxy->stream_head;
+    return ( size_t ) rate.info.tcpi_snd_cwnd * rate.info.tcpi_snd_mss;
+}
 
-    if ( proxy->stream_head )
-    {
-        proxy->stream_head->prev = stream;
+/**
+ * Get count of bytes given to the socket for sending so far
+ */
+int socket_bytes_written ( int sock, unsigned long long *bytes )
+{
+    int queued;
+    socklen_t len;
+    struct tcp_info_rate rate;
 
-    } else
+    memset ( &rate, '\0', sizeof ( rate ) );
+    len = sizeof ( rate );
+
+    /* Acknowledged bytes, SYN included, plus bytes still queued */
+    if ( getsockopt ( sock, IPPROTO_TCP, TCP_INFO, &rate, &len ) < 0
+        || len < offsetof ( struct tcp_info_rate, bytes_received )
+        || ioctl ( sock, SIOCOUTQ, &queued ) < 0 )
     {
-        proxy->stream_tail = stream;
+        return -1;
     }
 
-    proxy->stream_head = stream;
-
-    verbose ( "created new stream with socket:%i\n", sock );
+    *bytes = rate.bytes_acked + queued;
 
-    return stream;
+    return 0;
 }
 
 /**
- * Accept a new stream
+ * Size relay chunk and send buffer for data going to the stream
  */
-struct stream_t *accept_new_stream ( struct proxy_t *proxy, int lfd )
+static void relay_autotune ( struct proxy_t *proxy, struct stream_t *src, struct stream_t *dst )
 {
-    int sock;
-    struct stream_t *stream;
+    int value;
+    size_t bdp;
+    size_t chunk;
+    size_t sndbuf;
+    size_t extra = 0;
+    socklen_t len;
 
-    /* Accept incoming connection */
-    if ( ( sock = accept ( lfd, NULL, NULL ) ) < 0 )
+    if ( !( bdp = socket_path_bdp ( dst->fd ) ) )
     {
-        failure ( "cannot accept incoming connection (%i) on socket:%i\n", errno, lfd );
-        return NULL;
+        return;
     }
 
-    /* Set non-blocking mode on socket */
-    if ( socket_set_nonblocking ( proxy, sock ) < 0 )
+    /* Chunk holds half a window, grown only */
+    for ( chunk = FORWARD_CHUNK_LEN; chunk < bdp / 2 && chunk < FORWARD_CHUNK_MAX; chunk <<= 1 );
+    if ( chunk <= FORWARD_CHUNK_LEN || chunk <= src->relay_len )
     {
-        shutdown_then_close ( proxy, sock );
-        return NULL;
+        chunk = 0;
+
+    } else
+    {
+        extra += chunk - src->relay_len;
     }
 
-    /* Try allocating new stream */
-    if ( !( stream = insert_stream ( proxy, sock ) ) )
+    /* Send buffer holds two windows, left to the kernel while it keeps up */
+    sndbuf = bdp * 2 < TUNE_SNDBUF_MAX ? bdp * 2 : TUNE_SNDBUF_MAX;
+    len = sizeof ( value );
+    if ( getsockopt ( dst->fd, SOL_SOCKET, SO_SNDBUF, &value, &len ) < 0
+        || ( size_t ) value >= sndbuf )
     {
-        verbose ( "stream pool is full, need to force cleanup...\n" );
-        force_cleanup ( proxy, NULL );
-        stream = insert_stream ( proxy, sock );
+        sndbuf = 0;
+
+    } else
+    {
+        extra += sndbuf - dst->sndbuf;
     }
 
-    /* Check if stream was allocated */
-    if ( !stream )
+    if ( !extra )
     {
-        shutdown_then_close ( proxy, sock );
-        return NULL;
+        return;
     }
 
-    return stream;
+    if ( proxy->tune_used + extra > proxy->tune_limit )
+    {
+        verbose ( "tuning memory exhausted for socket:%i path bdp:%lu\n", dst->fd,
+            ( unsigned long ) bdp );
+        return;
+    }
+
+    if ( chunk )
+    {
+        proxy->tune_used += chunk - src->relay_len;
+        src->relay_len = chunk;
+    }
+
+    /* Kernel doubles the size set and caps it, account what was applied */
+    if ( sndbuf )
+    {
+        value = sndbuf / 2;
+        if ( setsockopt ( dst->fd, SOL_SOCKET, SO_SNDBUF, &value, sizeof ( value ) ) >= 0
+            && getsockopt ( dst->fd, SOL_SOCKET, SO_SNDBUF, &value, &len ) >= 0
+            && ( size_t ) value > dst->sndbuf )
+        {
+            proxy->tune_used += value - dst->sndbuf;
+            dst->sndbuf = value;
+        }
+    }
+
+    proxy->stat_tuned++;
+
+    verbose ( "tuned socket:%i path bdp:%lu chunk:%u sndbuf:%u\n", dst->fd,
+        ( unsigned long ) bdp, src->relay_len, dst->sndbuf );
 }
 
 /**
@@ -946,27 +2688,114 @@ struct stream_t *accept_new_stream ( struct proxy_t *proxy, int lfd )
  */
 int handle_forward_data ( struct proxy_t *proxy, struct stream_t *stream )
 {
+    int status = 0;
+    unsigned long tick;
+    unsigned long long forwarded;
+    struct stream_t *relation;
+    struct stream_t *neighbour;
+
     if ( !stream->neighbour || stream->level != LEVEL_FORWARDING )
     {
         return -1;
     }
 
-    if ( stream->revents & POLLOUT )
+    /* Activity is kept by the endpoint side, relisted once per tick */
+    relation = stream->role == S_PORT_B ? stream : stream->neighbour;
+    if ( relation->active != ( tick = proxy->now / TIMER_TICK_MSEC ) )
     {
-        if ( socket_forward_data ( proxy, stream->neighbour->fd, stream->fd ) < 0 )
+        /* Paths are sampled once per tuning interval while data moves */
+        if ( proxy->tune_limit
+            && tick / TUNE_INTERVAL_TICKS != relation->active / TUNE_INTERVAL_TICKS )
         {
-            return -1;
+            relay_autotune ( proxy, relation->neighbour, relation );
+            relay_autotune ( proxy, relation, relation->neighbour );
+        }
+        /* Relations are classified once per window */
+        if ( proxy->flows
+            && tick / FLOW_INTERVAL_TICKS != relation->active / FLOW_INTERVAL_TICKS )
+        {
+            flow_classify ( proxy, relation, 1 );
+        }
+        relation->active = tick;
+        stream_set_list ( proxy, relation, LIST_ESTABLISHED );
+    }
+
+    forwarded = proxy->stat_forwarded;
+
+    /* Neighbour events of this wakeup are served in the same dispatch */
+    neighbour = stream->neighbour;
+    if ( ( neighbour->revents & ( POLLERR | POLLHUP ) ) || neighbour->queue )
+    {
+        neighbour = NULL;
+    }
+
+    /* Relation reads at most a quantum per dispatch */
+    proxy->budget = FORWARD_QUANTUM;
+
+    if ( stream_edge_triggered ( proxy, stream ) )
+    {
+        /* Forward both directions until blocked or out of quantum */
+        if ( relay_stream_pair ( proxy, stream ) < 0 )
+        {
+            status = -1;
         }
 
-        stream->events &= ~POLLOUT;
-        stream->neighbour->events |= POLLIN;
+    } else if ( relay_stream_level ( proxy, stream ) < 0
+        || ( neighbour && neighbour->revents && relay_stream_level ( proxy, neighbour ) < 0 ) )
+    {
+        status = -1;
+
+    } else
+    {
+        relay_update_events ( proxy, stream );
+        relay_update_events ( proxy, stream->neighbour );
+    }
+
+    if ( neighbour )
+    {
+        neighbour->revents = 0;
+    }
+
+    relation->bytes += proxy->stat_forwarded - forwarded;
+
+    /* Volume turns interactive relation bulk within the window */
+    if ( proxy->flows && proxy->stat_forwarded != forwarded )
+    {
+        flow_classify ( proxy, relation, 0 );
+    }
+
+    /* Relation without backlog is handed over to the kernel once */
+    if ( !status && proxy->sockmap && sockmap_attach ( proxy, relation ) < 0 )
+    {
+        status = -1;
+    }
+
+    return status;
+}
+
+/**
+ * Resume stream data forward held back without events
+ */
+int resume_forward_data ( struct proxy_t *proxy, struct stream_t *stream )
+{
+    struct stream_t *neighbour = stream->neighbour;
+
+    proxy->budget = FORWARD_QUANTUM;
+
+    if ( stream_edge_triggered ( proxy, stream ) )
+    {
+        return relay_stream_pair ( proxy, stream );
+    }
 
-    } else if ( stream->revents & POLLIN )
+    if ( ( relay_pending ( proxy, stream ) && relay_send ( proxy, stream, neighbour ) < 0 )
+        || ( relay_pending ( proxy, neighbour ) && relay_send ( proxy, neighbour, stream ) < 0 ) )
     {
-        stream->events &= ~POLLIN;
-        stream->neighbour->events |= POLLOUT;
+        return -1;
     }
 
+    relay_update_events ( proxy, stream );
+    relay_update_events ( proxy, neighbour );
+
     return 0;
 }
 
@@ -980,34 +2809,38 @@ void show_stats ( struct proxy_t *proxy )
     int a_total = 0;
     int b_total = 0;
     int total = 0;
+    int list;
     struct stream_t *iter;
 
     if (proxy->verbose)
     {
-        for ( iter = proxy->stream_head; iter; iter = iter->next )
+        for ( list = 0; list < STREAM_LISTS; list++ )
         {
-            if ( iter->role == S_PORT_A )
+            for ( iter = proxy->stream_head[list]; iter; iter = iter->next )
             {
-                if ( iter->level == LEVEL_FORWARDING )
+                if ( iter->role == S_PORT_A )
                 {
-                    a_forwarding++;
-                }
-                a_total++;
+                    if ( iter->level == LEVEL_FORWARDING )
+                    {
+                        a_forwarding++;
+                    }
+                    a_total++;
 
-            } else if ( iter->role == S_PORT_B )
-            {
-                if ( iter->level == LEVEL_FORWARDING )
+                } else if ( iter->role == S_PORT_B )
                 {
-                    b_forwarding++;
+                    if ( iter->level == LEVEL_FORWARDING )
+                    {
+                        b_forwarding++;
+                    }
+                    b_total++;
                 }
-                b_total++;
-            }
 
-            total++;
+                total++;
+            }
         }
 
-        verbose ( "load: A:%i/%i B:%i/%i *:%i/%i\n", a_forwarding, a_total, b_forwarding,
-            b_total, total, POOL_SIZE );
+        verbose ( "load: A:%i/%i B:%i/%i *:%i/%lu\n", a_forwarding, a_total, b_forwarding,
+            b_total, total, ( unsigned long ) proxy->stream_limit );
     }
 }
 
@@ -1016,52 +2849,107 @@ void show_stats ( struct proxy_t *proxy )
  */
 void remove_stream ( struct proxy_t *proxy, struct stream_t *stream )
 {
+    /* Socket leaves the sockmap before it is closed */
+    if ( proxy->sockmap )
+    {
+        sockmap_release ( proxy, stream );
+    }
+
     if ( stream->fd >= 0 )
     {
-        if ( stream->pollref )
+        if ( stream->pollref && proxy->uring && uring_remove_stream ( proxy, stream ) >= 0 )
+        {
+            /* Closed with the next submission */
+
+        } else
         {
-            epoll_ctl ( proxy->epoll_fd, EPOLL_CTL_DEL, stream->fd, NULL );
+            if ( stream->pollref && proxy->epoll_fd >= 0 )
+            {
+                epoll_ctl ( proxy->epoll_fd, EPOLL_CTL_DEL, stream->fd, NULL );
+
+            } else if ( stream->pollref && !proxy->uring )
+            {
+                poll_list_remove ( proxy, stream );
+            }
+
+            shutdown_then_close ( proxy, stream->fd );
         }
 
-        shutdown_then_close ( proxy, stream->fd );
         stream->fd = -1;
     }
 
-    if ( stream == proxy->stream_head )
+    /* Return handshake queue if still held */
+    queue_release ( proxy, stream );
+    chunk_release ( proxy, stream );
+    pipe_release ( proxy, stream );
+    stream_clear_timer ( proxy, stream );
+    source_release ( proxy, stream );
+
+    if ( proxy->flows )
     {
-        proxy->stream_head = stream->next;
+        flow_release ( proxy, stream );
     }
 
-    if ( stream == proxy->stream_tail )
+    if ( stream->role == S_PORT_U )
     {
-        proxy->stream_tail = stream->prev;
+        udp_release ( proxy, stream );
     }
 
-    if ( stream->next )
+    /* Return buffer memory granted by tuning */
+    proxy->tune_used -= stream->relay_len + stream->sndbuf;
+
+    /* Unlink from dirty list */
+    if ( stream->dirty_link )
     {
-        stream->next->prev = stream->prev;
+        if ( ( *stream->dirty_link = stream->dirty_next ) )
+        {
+            stream->dirty_next->dirty_link = stream->dirty_link;
+        }
+        stream->dirty_link = NULL;
+        stream->dirty_next = NULL;
+        stream->dirty = 0;
     }
 
-    if ( stream->prev )
+    /* Drop events pending for dispatch */
+    if ( stream->ready_slot < proxy->ready_len && proxy->ready[stream->ready_slot] == stream )
     {
-        stream->prev->next = stream->next;
+        proxy->ready[stream->ready_slot] = NULL;
     }
 
+    stream_list_unlink ( proxy, stream );
+
     stream->allocated = 0;
+    stream->prev = NULL;
+    stream->next = proxy->free_head;
+    proxy->free_head = stream;
+    proxy->stream_count--;
 
     show_stats ( proxy );
 }
 
+/**
+ * Mark stream as abandoned
+ */
+static void abandon_stream ( struct proxy_t *proxy, struct stream_t *stream )
+{
+    if ( !stream->abandoned )
+    {
+        stream->abandoned = 1;
+        stream->abandoned_next = proxy->abandoned_head;
+        proxy->abandoned_head = stream;
+    }
+}
+
 /*
  * Abandon associated pair of streams
  */
-void remove_relation ( struct stream_t *stream )
+void remove_relation ( struct proxy_t *proxy, struct stream_t *stream )
 {
     if ( stream->neighbour )
     {
-        stream->neighbour->abandoned = 1;
+        abandon_stream ( proxy, stream->neighbour );
     }
-    stream->abandoned = 1;
+    abandon_stream ( proxy, stream );
 }
 
 /**
@@ -1069,84 +2957,113 @@ void remove_relation ( struct stream_t *stream )
  */
 void remove_all_streams ( struct proxy_t *proxy )
 {
+    int list;
     struct stream_t *iter;
     struct stream_t *next;
 
     verbose ( "removing all streams...\n" );
 
-    for ( iter = proxy->stream_head; iter; iter = next )
+    for ( list = 0; list < STREAM_LISTS; list++ )
     {
-        next = iter->next;
-        remove_stream ( proxy, iter );
-        iter = next;
+        for ( iter = proxy->stream_head[list]; iter; iter = next )
+        {
+            next = iter->next;
+            remove_stream ( proxy, iter );
+        }
     }
+
+    proxy->abandoned_head = NULL;
 }
 
 /**
- * Remove pending streams
+ * Remove abandoned streams
  */
-static void remove_pending_streams ( struct proxy_t *proxy )
+static void cleanup_streams ( struct proxy_t *proxy )
 {
     struct stream_t *iter;
 
-    for ( iter = proxy->stream_head; iter; iter = iter->next )
+    while ( ( iter = proxy->abandoned_head ) )
     {
-        if ( ( iter->role == S_PORT_A || iter->role == S_PORT_B )
-            && iter->level != LEVEL_FORWARDING )
-        {
-            verbose ( "cleaning up pending stream with socket:%i...\n", iter->fd );
-            remove_relation ( iter );
-        }
+        proxy->abandoned_head = iter->abandoned_next;
+        remove_stream ( proxy, iter );
     }
 }
 
 /**
- * Remove abandoned streams
+ * Evict least valuable relation to make room
  */
-static void cleanup_streams ( struct proxy_t *proxy )
+void force_cleanup ( struct proxy_t *proxy, const struct stream_t *excl )
 {
+    int list;
     struct stream_t *iter;
-    struct stream_t *next;
 
-    for ( iter = proxy->stream_head; iter; iter = next )
+    if ( proxy->abandoned_head )
     {
-        next = iter->next;
+        verbose ( "will remove abandoned streams...\n" );
+        cleanup_streams ( proxy );
+        return;
+    }
 
-        if ( iter->abandoned )
+    /* Stalled handshakes go first, then pending connects, then the longest idle */
+    for ( list = LIST_HANDSHAKE; list < STREAM_LISTS; list++ )
+    {
+        for ( iter = proxy->stream_tail[list]; iter; iter = iter->prev )
         {
-            remove_stream ( proxy, iter );
+            if ( !excl || ( iter != excl && iter->neighbour != excl ) )
+            {
+                verbose ( "need to get rid of stream with socket:%i idle for %lu ms after %llu"
+                    " byte(s)...\n", iter->fd, ( unsigned long ) ( proxy->now / TIMER_TICK_MSEC
+                        - iter->active ) * TIMER_TICK_MSEC, iter->bytes );
+                remove_relation ( proxy, iter );
+                cleanup_streams ( proxy );
+                return;
+            }
         }
     }
 }
 
 /**
- * Remove oldest forwarding relation
+ * Dispatch events of a ready stream
  */
-void force_cleanup ( struct proxy_t *proxy, const struct stream_t *excl )
+static int dispatch_stream ( struct proxy_t *proxy, struct stream_t *stream )
 {
-    struct stream_t *iter;
+    int fd;
+    int role;
+    int level;
+    unsigned long long start;
 
-    for ( iter = proxy->stream_tail; iter; iter = iter->prev )
+    if ( !stream->abandoned && stream->revents )
     {
-        if ( iter != excl && iter->abandoned )
+        if ( stream->revents & ( POLLERR | POLLHUP ) )
         {
-            verbose ( "will remove an abandoned stream with socket:%i...\n", iter->fd );
-            remove_relation ( iter );
-            remove_stream ( proxy, iter );
-            return;
-        }
-    }
+            verbose ( "stream with socket:%i got POLLERR/POLLHUP...\n", stream->fd );
+            remove_relation ( proxy, stream );
 
-    for ( iter = proxy->stream_tail; iter; iter = iter->prev )
-    {
-        if ( iter != excl && ( iter->role == S_PORT_A || iter->role == S_PORT_B ) )
+        } else if ( proxy->stall_threshold )
         {
-            verbose ( "need to get rid of stream with socket:%i...\n", iter->fd );
-            remove_relation ( iter );
-            remove_stream ( proxy, iter );
-            return;
+            /* Time each stream to name the one stalling the loop */
+            start = monotonic_usec (  );
+            fd = stream->fd;
+            role = stream->role;
+            level = stream->level;
+            proxy->dispatch_host[0] = '\0';
+
+            if ( handle_stream_events ( proxy, stream ) < 0 )
+            {
+                return -1;
+            }
+
+            loop_stream_done ( proxy, fd, role, level, start );
+
+        } else if ( handle_stream_events ( proxy, stream ) < 0 )
+        {
+            return -1;
         }
     }
+
+    stream->revents = 0;
+
+    return 0;
 }
 
 /**
@@ -1155,8 +3072,9 @@ void force_cleanup ( struct proxy_t *proxy, const struct stream_t *excl )
 int handle_streams_cycle ( struct proxy_t *proxy )
 {
     int status;
-    struct stream_t *iter;
-    struct stream_t *next;
+    size_t i;
+    size_t first;
+    struct stream_t *stream;
 
     /* Cleanup streams */
     cleanup_streams ( proxy );
@@ -1164,39 +3082,63 @@ int handle_streams_cycle ( struct proxy_t *proxy )
     /* Watch streams events */
     if ( ( status = watch_streams ( proxy ) ) < 0 )
     {
+        if ( errno == EINTR )
+        {
+            return 0;
+        }
         failure ( "failed to watch events (%i)\n", errno );
         return -1;
     }
 
+    /* Clock is read once per cycle */
+    proxy_clock_update ( proxy );
+    loop_wakeup ( proxy );
+
+    /* Drop streams past their deadlines */
+    expire_timers ( proxy );
+
+    if ( proxy->sockmap )
+    {
+        sockmap_sweep ( proxy );
+    }
+
     /* Do some cleanup */
     if ( !status )
     {
-        remove_pending_streams ( proxy );
         cleanup_streams ( proxy );
+        loop_dispatched ( proxy );
         return 0;
     }
 
-    /* Process stream list */
-    for ( iter = proxy->stream_head; iter; iter = next )
-    {
-        next = iter->next;
+    first = proxy->ready_start++;
 
-        if ( !iter->abandoned && iter->revents )
+    /* Interactive relations are served ahead of the rest */
+    if ( proxy->flow_interactive )
+    {
+        for ( i = 0; i < proxy->ready_len; i++ )
         {
-            if ( iter->revents & ( POLLERR | POLLHUP ) )
-            {
-                verbose ( "stream with socket:%i got POLLERR/POLLHUP...\n", iter->fd );
-                remove_relation ( iter );
-
-            } else
+            if ( ( stream = proxy->ready[( first + i ) % proxy->ready_len] )
+                && flow_interactive ( proxy, stream ) && dispatch_stream ( proxy, stream ) < 0 )
             {
-                if ( handle_stream_events ( proxy, iter ) < 0 )
-                {
-                    return -1;
-                }
+                proxy->ready_len = 0;
+                return -1;
             }
         }
     }
 
+    /* Process ready streams only, starting one further each cycle */
+    for ( i = 0; i < proxy->ready_len; i++ )
+    {
+        if ( ( stream = proxy->ready[( first + i ) % proxy->ready_len] )
+            && dispatch_stream ( proxy, stream ) < 0 )
+        {
+            proxy->ready_len = 0;
+            return -1;
+        }
+    }
+
+    proxy->ready_len = 0;
+    loop_dispatched ( proxy );
+
     return 0;
 }
@@ -0,0 +1,254 @@
+/* ------------------------------------------------------------------
+ * AxProxy - Worker Processes
+ * ------------------------------------------------------------------ */
+
+#include "axproxy.h"
+
+/**
+ * Worker pool signal flags
+ */
+static volatile sig_atomic_t exit_requested = 0;
+static volatile sig_atomic_t stats_requested = 0;
+
+/**
+ * Handle worker pool signals
+ */
+static void workers_signal_handler ( int signo )
+{
+    if ( signo == SIGUSR1 )
+    {
+        stats_requested = 1;
+
+    } else
+    {
+        exit_requested = 1;
+    }
+}
+
+/**
+ * Send signal to all running workers
+ */
+static void signal_workers ( struct proxy_t *proxy, const pid_t * pids, int signo )
+{
+    int i;
+
+    for ( i = 0; i < proxy->workers; i++ )
+    {
+        if ( pids[i] > 0 )
+        {
+            kill ( pids[i], signo );
+        }
+    }
+}
+
+/**
+ * Start a single worker process
+ */
+static pid_t spawn_worker ( struct proxy_t *proxy, const int *listen_fds, const int *cpus,
+    int id )
+{
+    int i;
+    pid_t pid;
+    cpu_set_t cpuset;
+
+    /* Do not let workers inherit pending output */
+    fflush ( NULL );
+
+    if ( ( pid = fork (  ) ) < 0 )
+    {
+        failure ( "cannot fork worker #%i (%i)\n", id, errno );
+        return -1;
+    }
+
+    if ( pid > 0 )
+    {
+        verbose ( "started worker #%i with pid:%i\n", id, ( int ) pid );
+        return pid;
+    }
+
+    /* Pin worker to its CPU, unpinned worker still serves its listen socket */
+    if ( proxy->cpu_pinning )
+    {
+        CPU_ZERO ( &cpuset );
+        CPU_SET ( cpus[id], &cpuset );
+        if ( sched_setaffinity ( 0, sizeof ( cpuset ), &cpuset ) < 0 )
+        {
+            failure ( "cannot pin worker #%i to cpu:%i (%i), running unpinned\n", id, cpus[id],
+                errno );
+
+        } else
+        {
+            proxy->worker_cpu = cpus[id];
+        }
+    }
+
+    /* Restore default signal handlers */
+    signal ( SIGTERM, SIG_DFL );
+    signal ( SIGINT, SIG_DFL );
+
+    /* Keep only own listen socket */
+    for ( i = 0; i < proxy->workers; i++ )
+    {
+        if ( i != id )
+        {
+            close ( listen_fds[i] );
+        }
+    }
+
+    proxy->worker_id = id;
+    proxy->listen_fd = listen_fds[id];
+
+    exit ( proxy_task ( proxy ) < 0 ? 1 : 0 );
+}
+
+/**
+ * Run proxy task in worker processes
+ */
+int proxy_workers ( struct proxy_t *proxy )
+{
+    int i;
+    int status;
+    int retval = 0;
+    int ncpus = 0;
+    int cpus[WORKERS_LIMIT];
+    pid_t pid;
+    pid_t pids[WORKERS_LIMIT];
+    int listen_fds[WORKERS_LIMIT];
+    cpu_set_t cpuset;
+    struct sigaction action;
+
+    /* One worker per CPU when steering connections */
+    if ( proxy->cpu_pinning )
+    {
+        /* Only CPUs the process may run on, ids may be sparse */
+        if ( sched_getaffinity ( 0, sizeof ( cpuset ), &cpuset ) < 0 )
+        {
+            failure ( "cannot get allowed cpus (%i)\n", errno );
+            return -1;
+        }
+
+        for ( i = 0; i < CPU_SETSIZE && ncpus < WORKERS_LIMIT; i++ )
+        {
+            if ( CPU_ISSET ( i, &cpuset ) )
+            {
+                cpus[ncpus++] = i;
+            }
+        }
+
+        if ( !ncpus || proxy->workers > ncpus )
+        {
+            failure ( "cannot pin %i workers to %i cpus\n", proxy->workers, ncpus );
+            return -1;
+        }
+
+        if ( !proxy->workers )
+        {
+            proxy->workers = ncpus;
+        }
+    }
+
+    /* Create listen sockets in worker order */
+    for ( i = 0; i < proxy->workers; i++ )
+    {
+        if ( ( listen_fds[i] = listen_socket ( proxy, &proxy->entrance ) ) < 0 )
+        {
+            while ( i-- )
+            {
+                shutdown_then_close ( proxy, listen_fds[i] );
+            }
+            return -1;
+        }
+        pids[i] = 0;
+    }
+
+    /* Select listen socket by incoming CPU */
+    if ( proxy->cpu_pinning
+        && listen_socket_steer_cpu ( proxy, listen_fds[0], cpus, proxy->workers ) < 0 )
+    {
+        for ( i = 0; i < proxy->workers; i++ )
+        {
+            shutdown_then_close ( proxy, listen_fds[i] );
+        }
+        return -1;
+    }
+
+    /* Setup signal handlers */
+    memset ( &action, '\0', sizeof ( action ) );
+    action.sa_handler = workers_signal_handler;
+    sigaction ( SIGTERM, &action, NULL );
+    sigaction ( SIGINT, &action, NULL );
+    sigaction ( SIGUSR1, &action, NULL );
+
+    /* Start workers */
+    for ( i = 0; i < proxy->workers; i++ )
+    {
+        if ( ( pids[i] = spawn_worker ( proxy, listen_fds, cpus, i ) ) < 0 )
+        {
+            exit_requested = 1;
+            retval = -1;
+            break;
+        }
+    }
+
+    verbose ( "worker pool setup was successful\n" );
+
+    /* Supervise workers */
+    while ( !exit_requested )
+    {
+        if ( ( pid = waitpid ( -1, &status, 0 ) ) < 0 )
+        {
+            if ( errno != EINTR )
+            {
+                failure ( "cannot wait for workers (%i)\n", errno );
+                retval = -1;
+                break;
+            }
+
+            if ( stats_requested )
+            {
+                stats_requested = 0;
+                signal_workers ( proxy, pids, SIGUSR1 );
+            }
+            continue;
+        }
+
+        for ( i = 0; i < proxy->workers; i++ )
+        {
+            if ( pids[i] == pid )
+            {
+                break;
+            }
+        }
+
+        if ( i == proxy->workers )
+        {
+            continue;
+        }
+
+        failure ( "worker #%i exited with status 0x%.4x, restarting...\n", i, status );
+        pids[i] = 0;
+        sleep ( WORKER_RESPAWN_SEC );
+
+        if ( !exit_requested && ( pids[i] = spawn_worker ( proxy, listen_fds, cpus, i ) ) < 0 )
+        {
+            retval = -1;
+            break;
+        }
+    }
+
+    /* Stop workers */
+    signal_workers ( proxy, pids, SIGTERM );
+
+    for ( i = 0; i < proxy->workers; i++ )
+    {
+        if ( pids[i] > 0 )
+        {
+            waitpid ( pids[i], &status, 0 );
+        }
+        shutdown_then_close ( proxy, listen_fds[i] );
+    }
+
+    verbose ( "done worker pool uninitializing\n" );
+
+    return retval;
+}